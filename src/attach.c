@@ -0,0 +1,345 @@
+/* Attach to the control socket of a running mcjoin, and show its groups
+ *
+ * Copyright (c) 2008-2025  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The groups of the data plane are added here as if they were given on
+ * the command line, and their counters and status history are updated
+ * from the snapshots, so all views work as usual.  The period counter
+ * follows the data plane, one frame is drawn per snapshot.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ctrl.h"
+#include "log.h"
+#include "mcjoin.h"
+#include "pev.h"
+
+char *attach_path;		/* -a PATH */
+
+static int         asd = -1;
+static struct gr **grp;		/* groups by index in CTRL_HELLO */
+static char       *abuf;
+static size_t      asize;
+static size_t      alen;
+
+/* Read exactly len bytes, only used before the event loop runs */
+static int readall(void *buf, size_t len)
+{
+	char *ptr = buf;
+
+	while (len > 0) {
+		ssize_t num;
+
+		num = read(asd, ptr, len);
+		if (num < 0 && errno == EINTR)
+			continue;
+		if (num <= 0) {
+			if (!num)
+				errno = ECONNRESET;
+			return -1;
+		}
+		ptr += num;
+		len -= num;
+	}
+
+	return 0;
+}
+
+static int groups_add(const struct ctrl_hello *h, const char *ptr, const char *end)
+{
+	const char *range = ptr;
+	struct gr *first = NULL;
+	uint64_t len = 0;
+	size_t i, r = 0, n = 0;
+
+	ptr += h->nrange * sizeof(len);
+	if (ptr > end)
+		goto invalid;
+
+	grp = calloc(h->num, sizeof(*grp));
+	if (!grp && h->num)
+		return -1;
+
+	for (i = 0; i < h->num; i++) {
+		const char *source = ptr, *group;
+
+		group = memchr(source, 0, end - source);
+		if (!group++ || !memchr(group, 0, end - group))
+			goto invalid;
+		ptr = group + strlen(group) + 1;
+
+		grp[i] = group_add(source[0] ? source : NULL, group);
+		if (!grp[i])
+			return -1;
+
+		/* same ranges as the data plane, for the aggregate view */
+		if (!first) {
+			first = grp[i];
+			len = 0;
+			if (r < h->nrange)
+				memcpy(&len, &range[r++ * sizeof(len)], sizeof(len));
+		}
+		if (++n < len)
+			continue;
+
+		if (group_range(first, n))
+			return -1;
+		first = NULL;
+		n = 0;
+	}
+
+	if (first && group_range(first, n))
+		return -1;
+
+	return 0;
+invalid:
+	errno = EPROTO;
+	return -1;
+}
+
+/*
+ * Connect to path, and set up the groups of the data plane.  Called
+ * instead of parsing groups from the command line.
+ */
+int attach_init(void)
+{
+	struct sockaddr_un sun = { 0 };
+	const char *cmd = "attach\n";
+	struct ctrl_hello h;
+	struct ctrl_msg msg;
+	char *buf = NULL;
+
+	sun.sun_family = AF_UNIX;
+	if (strlen(attach_path) >= sizeof(sun.sun_path)) {
+		ERROR("Too long control socket path, max %zu chars.", sizeof(sun.sun_path) - 1);
+		return 1;
+	}
+	strlcpy(sun.sun_path, attach_path, sizeof(sun.sun_path));
+
+	asd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (asd < 0 || connect(asd, (struct sockaddr *)&sun, sizeof(sun)))
+		goto fail;
+
+	if (write(asd, cmd, strlen(cmd)) < 0 || readall(&msg, sizeof(msg)))
+		goto fail;
+
+	if (msg.type != CTRL_HELLO || msg.len < sizeof(h) || msg.len > CTRL_MSG_MAX) {
+		ERROR("Not an mcjoin control socket: %s", attach_path);
+		return 1;
+	}
+
+	buf = malloc(msg.len);
+	if (!buf || readall(buf, msg.len))
+		goto fail;
+
+	memcpy(&h, buf, sizeof(h));
+	if (h.version != CTRL_VERSION) {
+		ERROR("Unsupported protocol version %u, of %s", h.version, attach_path);
+		free(buf);
+		return 1;
+	}
+
+	join     = !h.sender;
+	period   = h.period ?: 1;
+	hist_per = h.hist_per ?: 1;
+	strlcpy(iface, h.iface, sizeof(h.iface) < IFNAMSIZ ? sizeof(h.iface) : IFNAMSIZ);
+
+	if (groups_add(&h, buf + sizeof(h), buf + msg.len))
+		goto fail;
+
+	free(buf);
+	return 0;
+fail:
+	ERROR("Failed attaching to %s: %s", attach_path, strerror(errno));
+	free(buf);
+	return 1;
+}
+
+/* Update group from record, aggregates and problem score by the change */
+static void update(const struct ctrl_rec *r)
+{
+	struct gr *g = grp[r->idx];
+	struct grstat *st = g->st;
+	size_t problems;
+
+	problems = (r->lost - st->lost) + (r->dupes - st->dupes) + (r->order - st->order) +
+		(r->delayed - st->delayed) + (r->invalid - st->invalid);
+
+	agg_count(g, r->count - st->count, r->bytes - st->bytes);
+	count_lost(g, r->lost - st->lost);
+	if (problems)
+		top_update(g, problems);
+
+	st->bytes   = r->bytes;
+	st->count   = r->count;
+	st->gaps    = r->gaps;
+	st->dupes   = r->dupes;
+	st->order   = r->order;
+	st->delayed = r->delayed;
+	st->invalid = r->invalid;
+	st->frags   = r->frags;
+	st->trunc   = r->trunc;
+
+	if (r->status != ' ')
+		hist_set(g, r->status);
+}
+
+static void snapshot(const char *ptr, size_t len)
+{
+	struct ctrl_snap snap;
+	struct ctrl_rec rec;
+	size_t i;
+
+	if (len < sizeof(snap))
+		return;
+	memcpy(&snap, ptr, sizeof(snap));
+	if (snap.num > (len - sizeof(snap)) / sizeof(rec))
+		return;
+
+	htick = snap.htick;
+	for (i = 0, ptr += sizeof(snap); i < snap.num; i++, ptr += sizeof(rec)) {
+		memcpy(&rec, ptr, sizeof(rec));	/* may be unaligned */
+		if (rec.idx < group_num)
+			update(&rec);
+	}
+
+	present(0);
+}
+
+/* Groups changed in the data plane, replace all of ours */
+static void regroup(const char *ptr, size_t len)
+{
+	struct gr *g, *tmp;
+	struct ctrl_hello h;
+
+	if (len < sizeof(h))
+		return;
+	memcpy(&h, ptr, sizeof(h));
+
+	TAILQ_FOREACH_SAFE(g, &groups, entry, tmp)
+		group_del(g);
+	free(grp);
+	grp = NULL;
+
+	if (groups_add(&h, ptr + sizeof(h), ptr + len) || group_commit()) {
+		ERROR("Failed updating groups from %s: %s", attach_path, strerror(errno));
+		pev_exit(1);
+		return;
+	}
+
+	view_update();
+}
+
+static void message(uint32_t type, const char *ptr, size_t len)
+{
+	switch (type) {
+	case CTRL_HELLO:
+		regroup(ptr, len);
+		break;
+
+	case CTRL_SNAP:
+		snapshot(ptr, len);
+		break;
+
+	case CTRL_LOG:
+		logit(LOG_NOTICE, "%.*s\n", (int)len, ptr);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void attach_cb(int sd, void *arg)
+{
+	size_t pos = 0;
+	ssize_t num;
+
+	(void)arg;
+
+	if (asize - alen < 64 * 1024) {
+		size_t size = asize ? asize * 2 : 256 * 1024;
+		char *buf;
+
+		buf = realloc(abuf, size);
+		if (!buf) {
+			ERROR("Failed reading from %s: %s", attach_path, strerror(errno));
+			pev_exit(1);
+			return;
+		}
+		abuf  = buf;
+		asize = size;
+	}
+
+	num = read(sd, &abuf[alen], asize - alen);
+	if (num <= 0) {
+		if (num < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+
+		PRINT("Lost connection to %s", attach_path);
+		pev_sock_close(sd);
+		asd = -1;
+		return;
+	}
+	alen += num;
+
+	while (alen - pos >= sizeof(struct ctrl_msg)) {
+		struct ctrl_msg msg;
+
+		memcpy(&msg, &abuf[pos], sizeof(msg));
+		if (msg.len > CTRL_MSG_MAX) {
+			ERROR("Invalid message from %s, detaching", attach_path);
+			pev_sock_close(sd);
+			asd = -1;
+			return;
+		}
+		if (alen - pos - sizeof(msg) < msg.len)
+			break;
+
+		message(msg.type, &abuf[pos + sizeof(msg)], msg.len);
+		pos += sizeof(msg) + msg.len;
+	}
+
+	memmove(abuf, &abuf[pos], alen - pos);
+	alen -= pos;
+}
+
+/* Receive snapshots from the event loop */
+int attach_start(void)
+{
+	if (pev_sock_add(asd, attach_cb, NULL) < 0) {
+		ERROR("Failed attaching to %s: %s", attach_path, strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,249 @@
+/* Group churn, receiver leaves and re-joins groups at a target rate
+ *
+ * Copyright (c) 2008-2025  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * One group at a time is out.  Each cycle re-joins the group left in the
+ * previous cycle, and leaves the next one, round-robin or at random, so
+ * every group is out for one cycle.  The socket of a group is kept while
+ * it is out, only the membership changes, which is what IGMP snooping
+ * and PIM have to keep up with.
+ *
+ * Join latency is from the join to the first packet, leave latency from
+ * the leave to the last packet before the group is re-joined.  With
+ * sockets the kernel drops packets for groups left, so the latter only
+ * covers what was already queued.  With AF_XDP, -x, all packets on the
+ * wire are seen, and it is the time until the network stops forwarding.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "mcjoin.h"
+#include "pev.h"
+
+#define CHURN_TICK   10000	/* usec, shortest timer interval */
+
+struct lat {
+	size_t   num;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+};
+
+int    churn;			/* active */
+double churn_rate;		/* -C RATE, cycles/s */
+int    churn_random;		/* -C RATE:random */
+
+static struct gr **vec;		/* groups by index */
+static size_t      vlen;
+static size_t      next;	/* round-robin position */
+static struct gr  *out;		/* group left in last cycle */
+static double      credit;
+static int         tick;
+
+static struct lat  joins;
+static struct lat  leaves;
+static size_t      missed;	/* joins without any packet */
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void lat_add(struct lat *l, uint64_t usec)
+{
+	if (!l->num || usec < l->min)
+		l->min = usec;
+	if (usec > l->max)
+		l->max = usec;
+	l->sum += usec;
+	l->num++;
+}
+
+/* Called on every packet received, when churn is active */
+void churn_rx(struct gr *g)
+{
+	uint64_t now = now_usec();
+
+	if (g->cjoin) {
+		DEBUG("Group %s, first packet %.1f msec after join", g->group,
+		      (now - g->cjoin) / 1000.0);
+		lat_add(&joins, now - g->cjoin);
+		g->cjoin = 0;
+	}
+	g->clast = now;
+}
+
+static void rejoin(struct gr *g)
+{
+	uint64_t usec = g->clast > g->cleave ? g->clast - g->cleave : 0;
+
+	DEBUG("Group %s, last packet %.1f msec after leave", g->group, usec / 1000.0);
+	lat_add(&leaves, usec);
+
+	/* sender kept going, not a gap */
+	g->st->seq = 0;
+	g->cjoin   = now_usec();
+	receiver_churn(g, 1);
+}
+
+static void leave(struct gr *g)
+{
+	if (g->cjoin) {
+		DEBUG("Group %s, no packet since join", g->group);
+		missed++;
+		g->cjoin = 0;
+	}
+
+	g->cleave = now_usec();
+	receiver_churn(g, 0);
+}
+
+static struct gr *pick(const struct gr *prev)
+{
+	struct gr *g;
+
+	do {
+		if (churn_random)
+			g = vec[random() % vlen];
+		else
+			g = vec[next++ % vlen];
+	} while (g == prev);
+
+	return g;
+}
+
+static void cycle(void)
+{
+	struct gr *prev = out;
+
+	if (!vlen)
+		return;
+
+	if (out) {
+		rejoin(out);
+		out = NULL;
+
+		/* only one group, it is out every other cycle */
+		if (vlen == 1)
+			return;
+	}
+
+	out = pick(prev);
+	leave(out);
+}
+
+static void churn_cb(int id, void *arg)
+{
+	(void)id;
+	(void)arg;
+
+	credit += churn_rate * tick / 1000000;
+	while (credit >= 1) {
+		cycle();
+		credit -= 1;
+	}
+}
+
+/* Group about to be removed at runtime, see receiver_del() */
+void churn_del(struct gr *g)
+{
+	if (g == out)
+		out = NULL;
+}
+
+/* Groups added or removed at runtime, start over from the first */
+void churn_update(void)
+{
+	struct gr **tmp, *g;
+	size_t i = 0;
+
+	if (!churn)
+		return;
+
+	tmp = realloc(vec, (group_num ?: 1) * sizeof(*vec));
+	if (!tmp) {
+		ERROR("Failed allocating churn list: %s", strerror(errno));
+		vlen = 0;
+		return;
+	}
+	vec = tmp;
+
+	TAILQ_FOREACH(g, &groups, entry)
+		vec[i++] = g;
+	vlen = i;
+	next = 0;
+}
+
+int churn_init(void)
+{
+	if (churn_rate <= 0)
+		return 0;
+
+	tick = 1000000 / churn_rate;
+	if (tick < CHURN_TICK)
+		tick = CHURN_TICK;
+
+	churn = 1;
+	churn_update();
+	srandom(time(NULL));
+
+	if (pev_timer_add(tick, tick, churn_cb, NULL) < 0) {
+		ERROR("Failed starting group churn: %s", strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+static void show(const char *what, const struct lat *l)
+{
+	if (!l->num) {
+		PRINT("%s: none", what);
+		return;
+	}
+
+	PRINT("%s: %zu, latency min/avg/max %.1f/%.1f/%.1f msec", what, l->num,
+	      l->min / 1000.0, l->sum / 1000.0 / l->num, l->max / 1000.0);
+}
+
+void churn_show(void)
+{
+	if (!churn)
+		return;
+
+	show("Churn joins, to first packet", &joins);
+	show("Churn leaves, to last packet", &leaves);
+	if (missed)
+		PRINT("Churn joins without packets: %zu", missed);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,684 @@
+/* Control socket, for attached UI clients, see attach.c
+ *
+ * Copyright (c) 2008-2025  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Attached clients get the groups once, then a snapshot at the end of
+ * each history column, with only the groups updated in that column, and
+ * all log messages.  Everything is written with non-blocking sockets,
+ * from the event loop.  A client that has not taken the last snapshot
+ * when the next is due skips it, and gets all groups in the one after,
+ * so a slow client never holds up the data plane.
+ *
+ * The other commands change groups and rate at runtime, from the event
+ * loop, so the data plane never sees a group half set up.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ctrl.h"
+#include "log.h"
+#include "mcjoin.h"
+#include "pev.h"
+
+#define CTRL_CLIENTS  8		/* concurrent clients */
+#define CTRL_RETRY    10000	/* usec, between writes to slow clients */
+#define CTRL_BACKLOG  (1024 * 1024) /* pending bytes before log is dropped */
+#define CTRL_LINE     1024	/* max length of a command */
+
+char *ctrl_path;		/* -u PATH */
+
+struct buf {
+	char   *data;
+	size_t  size;
+	size_t  len;
+};
+
+struct client {
+	int         sd;
+	int         attached;
+	int         skip;	/* line too long, discard up to newline */
+	int         full;	/* all groups in next snapshot */
+	int         resync;	/* groups in next snapshot, when caught up */
+	char        line[CTRL_LINE];
+	size_t      llen;
+	struct buf  out;
+	size_t      off;	/* sent so far of out */
+};
+
+static struct client clients[CTRL_CLIENTS];
+static int ctid = -1;		/* retry timer */
+static int lsd  = -1;
+
+static int reserve(struct buf *b, size_t len)
+{
+	size_t size = b->size ? b->size : 64 * 1024;
+	char *data;
+
+	while (size - b->len < len)
+		size *= 2;
+	if (size == b->size)
+		return 0;
+
+	data = realloc(b->data, size);
+	if (!data)
+		return -1;
+	b->data = data;
+	b->size = size;
+
+	return 0;
+}
+
+static int put(struct buf *b, const void *data, size_t len)
+{
+	if (reserve(b, len))
+		return -1;
+
+	memcpy(&b->data[b->len], data, len);
+	b->len += len;
+
+	return 0;
+}
+
+/* Message of type, with the len bytes of b after pos */
+static void seal(struct buf *b, size_t pos, uint32_t type)
+{
+	struct ctrl_msg msg;
+
+	msg.type = type;
+	msg.len  = b->len - pos - sizeof(msg);
+	memcpy(&b->data[pos], &msg, sizeof(msg));
+}
+
+static int hello(struct buf *b)
+{
+	struct ctrl_hello h = { 0 };
+	struct ctrl_msg msg = { 0 };
+	size_t pos = b->len;
+	struct agg *a;
+	struct gr *g;
+
+	h.version  = CTRL_VERSION;
+	h.sender   = !join;
+	h.period   = period;
+	h.hist_per = hist_per;
+	h.num      = group_num;
+	h.nrange   = agg_num;
+	strlcpy(h.iface, iface, sizeof(h.iface));
+
+	if (put(b, &msg, sizeof(msg)) || put(b, &h, sizeof(h)))
+		return -1;
+
+	TAILQ_FOREACH(a, &aggs, entry) {
+		uint64_t num = a->num;
+
+		if (put(b, &num, sizeof(num)))
+			return -1;
+	}
+
+	TAILQ_FOREACH(g, &groups, entry) {
+		const char *source = g->source ?: "";
+
+		if (put(b, source, strlen(source) + 1) || put(b, g->group, strlen(g->group) + 1))
+			return -1;
+	}
+
+	seal(b, pos, CTRL_HELLO);
+	return 0;
+}
+
+/* Groups updated in the current column, or all */
+static int snapshot(struct buf *b, int full)
+{
+	struct ctrl_snap snap = { 0 };
+	struct ctrl_msg msg = { 0 };
+	size_t now = hist_now();
+	size_t pos = b->len;
+	uint32_t idx = 0;
+	struct gr *g;
+
+	snap.htick = htick;
+	if (put(b, &msg, sizeof(msg)) || put(b, &snap, sizeof(snap)))
+		return -1;
+
+	TAILQ_FOREACH(g, &groups, entry) {
+		const struct grstat *st = g->st;
+		struct ctrl_rec r = { 0 };
+
+		if (!full && st->hcol != now) {
+			idx++;
+			continue;
+		}
+
+		r.idx     = idx++;
+		r.status  = hist_status(g, now);
+		r.bytes   = st->bytes;
+		r.count   = st->count;
+		r.gaps    = st->gaps;
+		r.lost    = st->lost;
+		r.dupes   = st->dupes;
+		r.order   = st->order;
+		r.delayed = st->delayed;
+		r.invalid = st->invalid;
+		r.frags   = st->frags;
+		r.trunc   = st->trunc;
+		if (put(b, &r, sizeof(r)))
+			return -1;
+		snap.num++;
+	}
+
+	memcpy(&b->data[pos + sizeof(msg)], &snap, sizeof(snap));
+	seal(b, pos, CTRL_SNAP);
+
+	return 0;
+}
+
+static void drop(struct client *c)
+{
+	pev_sock_close(c->sd);
+	c->sd       = -1;
+	c->attached = 0;
+	c->resync   = 0;
+	c->skip     = 0;
+	c->llen     = 0;
+	c->out.len  = 0;
+	c->off      = 0;
+}
+
+/* Send as much as the client takes, returns 1 if there is more */
+static int send_more(struct client *c)
+{
+	while (c->off < c->out.len) {
+		ssize_t num;
+
+		num = send(c->sd, &c->out.data[c->off], c->out.len - c->off, MSG_NOSIGNAL);
+		if (num < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 1;
+
+			drop(c);
+			return 0;
+		}
+		c->off += num;
+	}
+
+	c->out.len = c->off = 0;
+	return 0;
+}
+
+static void retry_cb(int id, void *arg)
+{
+	int i, more = 0;
+
+	(void)id;
+	(void)arg;
+
+	for (i = 0; i < CTRL_CLIENTS; i++) {
+		if (clients[i].sd != -1 && clients[i].out.len)
+			more |= send_more(&clients[i]);
+	}
+
+	if (more)
+		pev_timer_set(ctid, CTRL_RETRY);
+}
+
+static void kick(struct client *c)
+{
+	if (send_more(c))
+		pev_timer_set(ctid, CTRL_RETRY);
+}
+
+static void reply(struct client *c, const char *msg)
+{
+	if (put(&c->out, msg, strlen(msg))) {
+		drop(c);
+		return;
+	}
+	kick(c);
+}
+
+static void attach(struct client *c)
+{
+	if (hello(&c->out) || snapshot(&c->out, 1)) {
+		ERROR("Failed composing groups for client: %s", strerror(errno));
+		drop(c);
+		return;
+	}
+
+	c->attached = 1;
+	c->resync   = 0;
+	kick(c);
+}
+
+/*
+ * Attached clients start over with all groups, those with a backlog
+ * when they have caught up, in ctrl_snapshot(), no snapshots until then
+ */
+static void resync(void)
+{
+	int i;
+
+	for (i = 0; i < CTRL_CLIENTS; i++) {
+		struct client *c = &clients[i];
+
+		if (c->sd == -1 || !c->attached)
+			continue;
+
+		if (c->out.len - c->off > CTRL_BACKLOG)
+			c->resync = 1;
+		else
+			attach(c);
+	}
+}
+
+/* Groups added or removed */
+static void changed(void)
+{
+	view_update();
+	shm_update();
+	xdp_update();
+	churn_update();
+	if (!join)
+		sender_update();
+
+	resync();
+}
+
+/* join SPEC [key=value]..., all groups are added before any is joined */
+static void join_cmd(struct client *c, char *args)
+{
+	char *argv[CTRL_LINE / 2 + 1], *ptr = NULL;
+	struct gr *last, *g, *tmp;
+	long num, failed = 0;
+	char msg[80];
+	int argc = 0;
+
+	argv[argc] = strtok_r(args, " \t", &ptr);
+	while (argv[argc])
+		argv[++argc] = strtok_r(NULL, " \t", &ptr);
+	if (!argc) {
+		reply(c, "ERR missing group\n");
+		return;
+	}
+
+	last = TAILQ_LAST(&groups, gr_list);
+	num = group_args(argc, argv);
+	if (num < 0) {
+		snprintf(msg, sizeof(msg), "ERR invalid group or option\n");
+		goto undo;
+	}
+
+	if (group_commit()) {
+		snprintf(msg, sizeof(msg), "ERR %s\n", strerror(errno));
+		goto undo;
+	}
+
+	/* one socket per group, fail up front rather than group by group */
+	if (join && receiver_nofile(group_num)) {
+		snprintf(msg, sizeof(msg), "ERR too many groups for the open files limit\n");
+		goto undo;
+	}
+
+	g = last ? TAILQ_NEXT(last, entry) : TAILQ_FIRST(&groups);
+	for (; join && g; g = tmp) {
+		tmp = TAILQ_NEXT(g, entry);
+		if (receiver_add(g)) {
+			group_del(g);
+			failed++;
+		}
+	}
+	group_commit();
+	changed();
+
+	if (failed)
+		snprintf(msg, sizeof(msg), "ERR failed joining %ld of %ld groups\n", failed, num);
+	else
+		snprintf(msg, sizeof(msg), "OK %ld groups\n", num);
+	reply(c, msg);
+	return;
+undo:
+	/* all or nothing, drop the groups of this command */
+	g = last ? TAILQ_NEXT(last, entry) : TAILQ_FIRST(&groups);
+	for (; g; g = tmp) {
+		tmp = TAILQ_NEXT(g, entry);
+		group_del(g);
+	}
+	group_commit();
+	reply(c, msg);
+}
+
+/* leave SPEC... */
+static void leave_cmd(struct client *c, char *args)
+{
+	char *spec, *ptr = NULL;
+	long num = 0;
+	char msg[80];
+
+	for (spec = strtok_r(args, " \t", &ptr); spec; spec = strtok_r(NULL, " \t", &ptr)) {
+		long rc;
+
+		rc = group_leave(spec, join ? receiver_del : NULL);
+		if (rc < 0) {
+			snprintf(msg, sizeof(msg), "ERR invalid group %.32s\n", spec);
+			goto done;
+		}
+		num += rc;
+	}
+	snprintf(msg, sizeof(msg), "OK %ld groups\n", num);
+done:
+	if (num) {
+		group_commit();
+		changed();
+	}
+	reply(c, msg);
+}
+
+static void rate_cmd(struct client *c, char *args)
+{
+	char *end;
+	long pps;
+
+	if (join) {
+		reply(c, "ERR not a sender\n");
+		return;
+	}
+
+	pps = strtol(args, &end, 10);
+	if (end == args || *end || pps < 0) {
+		reply(c, "ERR invalid rate\n");
+		return;
+	}
+
+	sender_rate(pps);
+	reply(c, "OK\n");
+}
+
+static void command(struct client *c, char *cmd)
+{
+	char *args;
+
+	args = cmd + strcspn(cmd, " \t");
+	if (*args)
+		*args++ = 0;
+	args += strspn(args, " \t");
+
+	if (!strcmp(cmd, "attach"))
+		attach(c);
+	else if (!strcmp(cmd, "join"))
+		join_cmd(c, args);
+	else if (!strcmp(cmd, "leave"))
+		leave_cmd(c, args);
+	else if (!strcmp(cmd, "rate"))
+		rate_cmd(c, args);
+	else if (!strcmp(cmd, "reset")) {
+		/* counters go down, attached clients start over */
+		group_reset();
+		resync();
+		reply(c, "OK\n");
+	} else if (cmd[0])
+		reply(c, "ERR unknown command\n");
+}
+
+static void client_cb(int sd, void *arg)
+{
+	struct client *c = arg;
+	char buf[1024];
+	ssize_t len, i;
+
+	len = recv(sd, buf, sizeof(buf), 0);
+	if (len <= 0) {
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		drop(c);
+		return;
+	}
+
+	/* attached clients only read, anything they send is ignored */
+	for (i = 0; i < len && c->sd != -1 && !c->attached; i++) {
+		if (buf[i] == '\r')
+			continue;
+		if (buf[i] != '\n') {
+			if (c->skip)
+				continue;
+			if (c->llen < sizeof(c->line) - 1) {
+				c->line[c->llen++] = buf[i];
+				continue;
+			}
+
+			reply(c, "ERR line too long\n");
+			c->llen = 0;
+			c->skip = 1;
+			continue;
+		}
+
+		if (c->skip) {
+			c->skip = 0;
+			continue;
+		}
+
+		c->line[c->llen] = 0;
+		c->llen = 0;
+		command(c, c->line);
+	}
+}
+
+static void accept_cb(int sd, void *arg)
+{
+	struct client *c = NULL;
+	int i, cd;
+
+	(void)arg;
+
+	cd = accept(sd, NULL, NULL);
+	if (cd < 0)
+		return;
+
+	for (i = 0; i < CTRL_CLIENTS; i++) {
+		if (clients[i].sd == -1) {
+			c = &clients[i];
+			break;
+		}
+	}
+
+	if (!c || fcntl(cd, F_SETFL, O_NONBLOCK) || pev_sock_add(cd, client_cb, c) < 0) {
+		close(cd);
+		return;
+	}
+
+	c->sd   = cd;
+	c->full = 0;
+}
+
+/* Log messages to attached clients, sent from retry_cb() */
+static void ctrl_log(const char *msg)
+{
+	size_t len = strlen(msg);
+	int i, more = 0;
+
+	while (len > 0 && msg[len - 1] == '\n')
+		len--;
+	while (len > 0 && *msg == '\n') {
+		msg++;
+		len--;
+	}
+
+	for (i = 0; i < CTRL_CLIENTS; i++) {
+		struct client *c = &clients[i];
+		struct ctrl_msg hdr;
+
+		if (c->sd == -1 || !c->attached || c->out.len - c->off > CTRL_BACKLOG)
+			continue;
+
+		hdr.type = CTRL_LOG;
+		hdr.len  = len;
+		if (put(&c->out, &hdr, sizeof(hdr)) || put(&c->out, msg, len))
+			continue;
+		more = 1;
+	}
+
+	if (more)
+		pev_timer_set(ctid, CTRL_RETRY);
+}
+
+/*
+ * Called at the end of each history column.  The snapshots are composed
+ * at most once each, and only if there are attached clients.
+ */
+void ctrl_snapshot(void)
+{
+	static struct buf part, full;
+	int i, more = 0;
+
+	part.len = full.len = 0;
+	for (i = 0; i < CTRL_CLIENTS; i++) {
+		struct client *c = &clients[i];
+		struct buf *b;
+
+		if (c->sd == -1 || !c->attached)
+			continue;
+
+		/* still sending the last one, skip */
+		if (c->out.len && send_more(c)) {
+			c->full = 1;
+			continue;
+		}
+		if (c->sd == -1)
+			continue;
+
+		/* caught up, now all groups */
+		if (c->resync) {
+			attach(c);
+			continue;
+		}
+
+		b = c->full ? &full : &part;
+		if (!b->len && snapshot(b, c->full)) {
+			ERROR("Failed composing snapshot: %s", strerror(errno));
+			b->len = 0;
+			continue;
+		}
+
+		if (put(&c->out, b->data, b->len)) {
+			drop(c);
+			continue;
+		}
+		c->full = 0;
+		more |= send_more(c);
+	}
+
+	if (more)
+		pev_timer_set(ctid, CTRL_RETRY);
+}
+
+/* Remove socket left by an mcjoin that is no longer running */
+static int stale(const struct sockaddr_un *sun)
+{
+	int sd, rc = 0;
+
+	sd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sd < 0)
+		return 0;
+
+	if (connect(sd, (const struct sockaddr *)sun, sizeof(*sun)) && errno == ECONNREFUSED)
+		rc = !unlink(sun->sun_path);
+	close(sd);
+
+	errno = EADDRINUSE;
+	return rc;
+}
+
+/* Listen on unix socket ctrl_path */
+int ctrl_init(void)
+{
+	struct sockaddr_un sun = { 0 };
+	int i;
+
+	if (!ctrl_path)
+		return 0;
+
+	for (i = 0; i < CTRL_CLIENTS; i++)
+		clients[i].sd = -1;
+
+	sun.sun_family = AF_UNIX;
+	if (strlen(ctrl_path) >= sizeof(sun.sun_path)) {
+		ERROR("Too long control socket path, max %zu chars.", sizeof(sun.sun_path) - 1);
+		return 1;
+	}
+	strlcpy(sun.sun_path, ctrl_path, sizeof(sun.sun_path));
+
+	lsd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (lsd < 0)
+		goto fail;
+
+	if (bind(lsd, (struct sockaddr *)&sun, sizeof(sun))) {
+		if (errno != EADDRINUSE || !stale(&sun) ||
+		    bind(lsd, (struct sockaddr *)&sun, sizeof(sun)))
+			goto fail;
+	}
+
+	if (listen(lsd, CTRL_CLIENTS) || pev_sock_add(lsd, accept_cb, NULL) < 0)
+		goto fail;
+
+	ctid = pev_timer_add(CTRL_RETRY, 0, retry_cb, NULL);
+	if (ctid < 0)
+		goto fail;
+
+	log_tap = ctrl_log;
+	return 0;
+fail:
+	ERROR("Failed setting up control socket %s: %s", ctrl_path, strerror(errno));
+	if (lsd >= 0) {
+		close(lsd);
+		lsd = -1;
+	}
+	return 1;
+}
+
+void ctrl_exit(void)
+{
+	int i;
+
+	if (lsd < 0)
+		return;
+
+	log_tap = NULL;
+	for (i = 0; i < CTRL_CLIENTS; i++) {
+		if (clients[i].sd != -1)
+			drop(&clients[i]);
+	}
+
+	pev_sock_close(lsd);
+	unlink(ctrl_path);
+	lsd = -1;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2008-2025  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MCJOIN_CTRL_H_
+#define MCJOIN_CTRL_H_
+
+#include <stdint.h>
+
+/*
+ * Control socket protocol.  Commands are text lines, after the "attach"
+ * command the data plane instead streams messages, each a struct ctrl_msg
+ * followed by len bytes, in host byte order since the socket is local:
+ *
+ * CTRL_HELLO: struct ctrl_hello, nrange uint64_t with the number of groups
+ *             in each range, then source and group of each group, as two
+ *             NUL terminated strings, source is empty for ASM.  Sent again,
+ *             followed by a full snapshot, when groups are changed
+ * CTRL_SNAP:  struct ctrl_snap, then num struct ctrl_rec, at the end of
+ *             each history column, with the groups updated in it
+ * CTRL_LOG:   one log message, without newline
+ */
+#define CTRL_VERSION   1
+#define CTRL_MSG_MAX   (256 * 1024 * 1024)
+
+enum {
+	CTRL_HELLO = 1,
+	CTRL_SNAP,
+	CTRL_LOG,
+};
+
+struct ctrl_msg {
+	uint32_t type;
+	uint32_t len;
+};
+
+struct ctrl_hello {
+	uint32_t version;
+	uint32_t sender;
+	uint32_t period;	/* usec */
+	uint32_t hist_per;	/* periods per column */
+	uint64_t num;		/* groups */
+	uint64_t nrange;
+	char     iface[16];
+};
+
+struct ctrl_snap {
+	uint64_t htick;
+	uint64_t num;
+};
+
+struct ctrl_rec {
+	uint32_t idx;		/* position in CTRL_HELLO */
+	char     status;	/* of current history column */
+	char     pad[3];
+	uint64_t bytes;
+	uint64_t count;
+	uint64_t gaps;
+	uint64_t lost;
+	uint64_t dupes;
+	uint64_t order;
+	uint64_t delayed;
+	uint64_t invalid;
+	uint64_t frags;
+	uint64_t trunc;
+};
+
+#endif /* MCJOIN_CTRL_H_ */
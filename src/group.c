@@ -0,0 +1,1147 @@
+/* Group state, allocation and layout
+ *
+ * Copyright (c) 2008-2025  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Groups are set up from the command line, before the event loop is
+ * started, and can be added and removed at runtime, see ctrl.c.  The
+ * struct gr of each group is allocated in chunks, and holds names,
+ * addresses, and other data that is only used at setup or by the UI.
+ * Everything touched per packet is in dense, cache line aligned, arrays
+ * of struct grstat, one per batch of groups added, and the status
+ * history and seqnos bitmaps are in separate arrays, sized after the
+ * screen and the role (sender/receiver).  This keeps 100k groups within
+ * tens of MiB.  Removed groups keep their state, for the next group
+ * added, so nothing is freed while packets may still be accounted.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "inetaddr.h"
+#include "mcjoin.h"
+
+#define GROUP_CHUNK  256	/* struct gr allocated this many at a time */
+#define SPEC_BITS    20		/* Max groups in one spec, as bits */
+#define SPEC_MAX     (1 << SPEC_BITS)
+#define AGG_BLOCK    256	/* Groups per block of a large range */
+#define TOP_HALFLIFE 10000000	/* Weight of problems halved every 10 sec */
+#define TOP_RENORM   24		/* Rescale scores when weight reaches 2^24 */
+
+size_t hist_len = 2;		/* Power of two, columns of history */
+size_t hist_per = 1;		/* Periods per column */
+
+struct agg_list aggs = TAILQ_HEAD_INITIALIZER(aggs);
+size_t agg_num;
+
+char  *group_file;		/* -F FILE */
+
+struct source {
+	struct source *next;
+	char           name[];
+};
+
+static struct gr_list unused = TAILQ_HEAD_INITIALIZER(unused);
+static struct source *sources;
+static struct gr *pool;
+static size_t     pool_free;
+static size_t     pending;	/* groups added without state */
+static int        group_rx;
+static int        agg_dirty;	/* groups removed, see agg_fixup() */
+
+/* Parsed [SOURCE,]GROUP[:PORT][+NUM], and key=value options */
+struct spec {
+	inet_addr_t  grp;	/* first group, with port */
+	inet_addr_t  src;
+	const char  *source;	/* shared, NULL for ASM */
+	size_t       num;
+	struct profile prof;
+};
+
+static struct gr *top[TOP_MAX];	/* min-heap on score */
+static size_t     top_num;
+static size_t     top_base;		/* scores are relative to this shift */
+
+
+/* Reset state of a removed group, for reuse */
+static void group_reuse(struct gr *g)
+{
+	struct grstat *st = g->st;
+	uint64_t *seen = g->seen;
+	char *status = g->status;
+	struct zcbuf *zc = g->zc;
+
+	memset(g, 0, sizeof(*g));
+	g->st     = st;
+	g->seen   = seen;
+	g->status = status;
+	g->zc     = zc;
+
+	/* removed before it got any state */
+	if (!st) {
+		pending++;
+		return;
+	}
+
+	memset(st, 0, sizeof(*st));
+	memset(status, ' ', hist_len);
+	if (seen)
+		memset(seen, 0, DUP_WINDOW / 8);
+	st->hcol = hist_now();
+}
+
+/* Sources are few, each is kept once for all its groups, never freed */
+static const char *source_get(const char *name)
+{
+	struct source *src;
+	size_t len;
+
+	for (src = sources; src; src = src->next) {
+		if (src->name == name || !strcmp(src->name, name))
+			return src->name;
+	}
+
+	len = strlen(name) + 1;
+	src = malloc(sizeof(*src) + len);
+	if (!src)
+		return NULL;
+	memcpy(src->name, name, len);
+	src->next = sources;
+	sources   = src;
+
+	return src->name;
+}
+
+/* Allocate a new group, and add it to the list of groups */
+struct gr *group_add(const char *source, const char *group)
+{
+	struct gr *g;
+
+	g = TAILQ_FIRST(&unused);
+	if (g) {
+		TAILQ_REMOVE(&unused, g, entry);
+		group_reuse(g);
+	} else {
+		if (!pool_free) {
+			pool = calloc(GROUP_CHUNK, sizeof(*pool));
+			if (!pool)
+				return NULL;
+			pool_free = GROUP_CHUNK;
+		}
+
+		g = pool++;
+		pool_free--;
+		pending++;
+	}
+
+	if (strlcpy(g->gname, group, sizeof(g->gname)) < sizeof(g->gname))
+		g->group = g->gname;
+	else
+		g->group = strdup(group);
+	if (!g->group)
+		return NULL;
+	if (source) {
+		g->source = source_get(source);
+		if (!g->source)
+			return NULL;
+	}
+	g->sd = -1;
+
+	TAILQ_INSERT_TAIL(&groups, g, entry);
+	group_num++;
+
+	return g;
+}
+
+/* Last 32 bits of an address, ranges are stepped in these */
+static uint32_t addr_low(const inet_addr_t *ss)
+{
+	uint32_t val;
+
+#ifdef AF_INET6
+	if (ss->ss_family == AF_INET6) {
+		memcpy(&val, &((const struct sockaddr_in6 *)ss)->sin6_addr.s6_addr[12], sizeof(val));
+		return ntohl(val);
+	}
+#endif
+	return ntohl(((const struct sockaddr_in *)ss)->sin_addr.s_addr);
+}
+
+static void addr_set_low(inet_addr_t *ss, uint32_t low)
+{
+	uint32_t val = htonl(low);
+
+#ifdef AF_INET6
+	if (ss->ss_family == AF_INET6) {
+		memcpy(&((struct sockaddr_in6 *)ss)->sin6_addr.s6_addr[12], &val, sizeof(val));
+		return;
+	}
+#endif
+	((struct sockaddr_in *)ss)->sin_addr.s_addr = val;
+}
+
+/* Same address, the port of a source is ignored */
+static int addr_same(const inet_addr_t *a, const inet_addr_t *b, int port)
+{
+	if (a->ss_family != b->ss_family)
+		return 0;
+	if (port && inet_addr_get_port((inet_addr_t *)a) != inet_addr_get_port((inet_addr_t *)b))
+		return 0;
+
+#ifdef AF_INET6
+	if (a->ss_family == AF_INET6)
+		return !memcmp(&((const struct sockaddr_in6 *)a)->sin6_addr,
+			       &((const struct sockaddr_in6 *)b)->sin6_addr, 16);
+#endif
+	return ((const struct sockaddr_in *)a)->sin_addr.s_addr ==
+		((const struct sockaddr_in *)b)->sin_addr.s_addr;
+}
+
+/* Name of group address, without inet_ntop() for IPv4, called per group */
+static void addr_name(const inet_addr_t *ss, char *buf, size_t len)
+{
+	uint32_t addr;
+	char *ptr = buf;
+	int i;
+
+	if (ss->ss_family != AF_INET) {
+		inet_address((inet_addr_t *)ss, buf, len);
+		return;
+	}
+
+	addr = ntohl(((const struct sockaddr_in *)ss)->sin_addr.s_addr);
+	for (i = 24; i >= 0; i -= 8) {
+		unsigned int octet = (addr >> i) & 0xff;
+
+		if (octet >= 100)
+			*ptr++ = '0' + octet / 100;
+		if (octet >= 10)
+			*ptr++ = '0' + octet / 10 % 10;
+		*ptr++ = '0' + octet % 10;
+		*ptr++ = i ? '.' : 0;
+	}
+}
+
+static int spec_source(struct spec *s, const char *source)
+{
+	void *ptr = &((struct sockaddr_in *)&s->src)->sin_addr;
+	int family = s->grp.ss_family;
+	int port;
+
+#ifdef AF_INET6
+	if (family == AF_INET6)
+		ptr = &((struct sockaddr_in6 *)&s->src)->sin6_addr;
+#endif
+	memset(&s->src, 0, sizeof(s->src));
+	if (inet_pton_port(family, source, ptr, &port, 0))
+		return -1;
+
+	s->src.ss_family = family;
+	inet_addr_set_port(&s->src, htons(port));
+#ifdef HAVE_STRUCT_SOCKADDR_STORAGE_SS_LEN
+	s->src.ss_len = inet_addrlen(&s->src);
+#endif
+	s->source = source_get(source);
+	if (!s->source)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Parse [SOURCE,]GROUP[:PORT], followed by one of +NUM, /LEN for all
+ * groups of a prefix, or -LAST for all groups up to LAST.  Ranges are
+ * only in the last 32 bits of an IPv6 group.
+ */
+static int spec_parse(const char *arg, struct spec *s)
+{
+	char buf[3 * INET_ADDRSTR_LEN + 16];
+	char *pos, *group = buf, *source = NULL, *last = NULL;
+	int family = AF_INET, plen = -1, forms = 0;
+	unsigned long num = 1;
+	void *gptr;
+	int gport;
+
+	memset(s, 0, sizeof(*s));
+	if (strlcpy(buf, arg, sizeof(buf)) >= sizeof(buf))
+		goto invalid;
+
+	pos = strchr(buf, '+');
+	if (pos) {
+		*pos++ = 0;
+		num = strtoul(pos, &pos, 10);
+		if (*pos || num < 1 || num > SPEC_MAX)
+			goto range;
+		forms++;
+	}
+
+	pos = strchr(buf, '/');
+	if (pos) {
+		char *end;
+
+		*pos++ = 0;
+		plen = strtoul(pos, &end, 10);
+		if (*end || end == pos)
+			goto invalid;
+		forms++;
+	}
+
+	pos = strchr(buf, '-');
+	if (pos) {
+		*pos++ = 0;
+		last = pos;
+		forms++;
+	}
+
+	if (forms > 1)
+		goto invalid;
+
+	pos = strchr(group, ',');
+	if (pos) {
+		*pos++ = 0;
+		source = group;
+		group  = pos;
+	}
+
+#ifdef AF_INET6
+	if (inet_ip6(group)) {
+		family = AF_INET6;
+		gptr = &((struct sockaddr_in6 *)&s->grp)->sin6_addr;
+	} else
+#endif
+		gptr = &((struct sockaddr_in *)&s->grp)->sin_addr;
+
+	if (inet_pton_port(family, group, gptr, &gport, port))
+		goto invalid;
+	s->grp.ss_family = family;
+	inet_addr_set_port(&s->grp, htons(gport));
+#ifdef HAVE_STRUCT_SOCKADDR_STORAGE_SS_LEN
+	s->grp.ss_len = inet_addrlen(&s->grp);
+#endif
+
+	if (plen >= 0) {
+		int bits = family == AF_INET ? 32 : 128;
+
+		if (plen > bits || bits - plen > SPEC_BITS)
+			goto range;
+		num = 1UL << (bits - plen);
+		addr_set_low(&s->grp, addr_low(&s->grp) & ~(uint32_t)(num - 1));
+	}
+
+	if (last) {
+		inet_addr_t end = s->grp;
+		uint32_t lo, hi;
+
+		if (inet_pton(family, last, family == AF_INET
+			      ? (void *)&((struct sockaddr_in *)&end)->sin_addr
+			      : (void *)&((struct sockaddr_in6 *)&end)->sin6_addr) != 1) {
+			group = last;
+			goto invalid;
+		}
+
+		lo = addr_low(&s->grp);
+		hi = addr_low(&end);
+		addr_set_low(&end, lo);
+		if (hi < lo || !addr_same(&s->grp, &end, 0) || hi - lo >= SPEC_MAX)
+			goto range;
+		num = hi - lo + 1;
+	}
+
+	if (source && spec_source(s, source)) {
+		group = source;
+		goto invalid;
+	}
+	s->num = num;
+
+	return 0;
+range:
+	ERROR("Invalid number of groups in %s, max %d.", arg, SPEC_MAX);
+	errno = EINVAL;
+	return -1;
+invalid:
+	ERROR("%s is not a valid multicast group", group);
+	errno = EINVAL;
+	return -1;
+}
+
+/* Add the groups of a spec, returns the first, or NULL on error */
+static struct gr *spec_add(struct spec *s)
+{
+	inet_addr_t grp = s->grp;
+	struct gr *first = NULL;
+	size_t i;
+
+	for (i = 0; i < s->num; i++) {
+		char buf[INET_ADDRSTR_LEN];
+		struct gr *g;
+
+		addr_name(&grp, buf, sizeof(buf));
+		g = group_add(s->source, buf);
+		if (!g) {
+			ERROR("Failed allocating groups: %s", strerror(errno));
+			return NULL;
+		}
+		if (!first)
+			first = g;
+
+		g->grp  = grp;
+		g->src  = s->src;
+		g->prof = s->prof;
+		g->spin = buf[strlen(buf) - 1];
+		if (grp.ss_family == AF_INET)
+			need4++;
+		else
+			need6++;
+
+		addr_set_low(&grp, addr_low(&grp) + 1);
+	}
+
+	return first;
+}
+
+/*
+ * Add the groups of [SOURCE,]GROUP[:PORT][+NUM|/LEN|-LAST], as one
+ * range.  All groups of a range have the same source and port.  Returns
+ * number of groups added, or -1 on error.
+ */
+long group_parse(const char *arg)
+{
+	struct gr *first;
+	struct spec s;
+
+	if (spec_parse(arg, &s))
+		return -1;
+
+	DEBUG("Adding (S,G) %s,%s to list ...", s.source ?: "*", arg);
+	first = spec_add(&s);
+	if (!first || group_range(first, s.num))
+		return -1;
+
+	return s.num;
+}
+
+static int opt_num(const char *val, unsigned long max, uint32_t *num)
+{
+	unsigned long n;
+	char *end;
+
+	n = strtoul(val, &end, 10);
+	if (*end || end == val || n < 1 || n > max)
+		return -1;
+	*num = n;
+
+	return 0;
+}
+
+/*
+ * Apply one key=value option to a spec: port and source override those
+ * of the group, rate, size and burst are the sender profile of it.
+ */
+static int spec_opt(struct spec *s, const char *opt)
+{
+	const char *val = strchr(opt, '=');
+
+	if (!val++)
+		return -1;
+
+	if (!strncmp(opt, "port=", 5)) {
+		int num = inet_port(val);
+
+		if (num < 0)
+			return -1;
+		inet_addr_set_port(&s->grp, htons(num));
+		return 0;
+	}
+	if (!strncmp(opt, "source=", 7))
+		return spec_source(s, val);
+	if (!strncmp(opt, "rate=", 5))
+		return opt_num(val, 10000000, &s->prof.pps);
+	if (!strncmp(opt, "size=", 5)) {
+		s->prof.sizes = NULL;
+		if (!opt_num(val, PAYLOAD_MAX, &s->prof.size))
+			return s->prof.size < PAYLOAD_MIN ? -1 : 0;
+
+		s->prof.sizes = sizes_get(val);
+		if (!s->prof.sizes)
+			return -1;
+		s->prof.size = sizes_max(s->prof.sizes);
+		return 0;
+	}
+	if (!strncmp(opt, "burst=", 6))
+		return opt_num(val, 65536, &s->prof.burst);
+
+	return -1;
+}
+
+/* Apply key=value options of a line in a group file */
+static int spec_opts(struct spec *s, char *opts, int lineno)
+{
+	char *opt, *ptr = NULL;
+
+	for (opt = strtok_r(opts, " \t\r", &ptr); opt; opt = strtok_r(NULL, " \t\r", &ptr)) {
+		if (spec_opt(s, opt)) {
+			ERROR("%s:%d: invalid option %s", group_file, lineno, opt);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Add groups of command line, or control socket, arguments.  Each is a
+ * group spec, see group_parse(), optionally followed by key=value
+ * options for it, like in a group file.  Returns number of groups
+ * added, or -1 on error.
+ */
+long group_args(int argc, char *argv[])
+{
+	long total = 0;
+	int i, j;
+
+	for (i = 0; i < argc; i = j) {
+		struct gr *first;
+		struct spec s;
+
+		if (spec_parse(argv[i], &s))
+			return -1;
+
+		for (j = i + 1; j < argc && strchr(argv[j], '='); j++) {
+			if (spec_opt(&s, argv[j])) {
+				ERROR("Invalid option %s for %s", argv[j], argv[i]);
+				errno = EINVAL;
+				return -1;
+			}
+		}
+
+		DEBUG("Adding (S,G) %s,%s to list ...", s.source ?: "*", argv[i]);
+		first = spec_add(&s);
+		if (!first || group_range(first, s.num))
+			return -1;
+		total += s.num;
+	}
+
+	return total;
+}
+
+static int prof_same(const struct profile *a, const struct profile *b)
+{
+	return a->size == b->size && a->pps == b->pps && a->burst == b->burst &&
+		a->sizes == b->sizes;
+}
+
+/*
+ * Read group file, each line a group spec, see group_parse(), followed
+ * by optional key=value options, see spec_opt().  Lines continuing the
+ * range of the line above, same source, port and profile, are added to
+ * it.  The whole file is read in one go, and groups are added without
+ * any temporaries, so 100k groups load in milliseconds.
+ */
+long group_load(void)
+{
+	struct gr *first = NULL;
+	inet_addr_t next = { 0 };
+	const char *source = NULL;
+	struct profile prof = { 0 };
+	size_t size = 0, len = 0;
+	char *buf = NULL, *line;
+	int fd, lineno = 0;
+	long total = 0, num = 0;
+	ssize_t rc;
+
+	if (!group_file)
+		return 0;
+
+	fd = strcmp(group_file, "-") ? open(group_file, O_RDONLY) : STDIN_FILENO;
+	if (fd < 0)
+		goto fail;
+
+	do {
+		if (size - len < 4096) {
+			char *tmp;
+
+			size = size ? size * 2 : 64 * 1024;
+			tmp = realloc(buf, size + 1);
+			if (!tmp)
+				goto fail;
+			buf = tmp;
+		}
+
+		rc = read(fd, &buf[len], size - len);
+		if (rc < 0 && errno != EINTR)
+			goto fail;
+		if (rc > 0)
+			len += rc;
+	} while (rc);
+	buf[len] = 0;
+	if (fd != STDIN_FILENO)
+		close(fd);
+	fd = -1;
+
+	for (line = buf; line && *line; ) {
+		char *end = strchr(line, '\n'), *opts;
+		struct spec s;
+
+		if (end)
+			*end++ = 0;
+		lineno++;
+
+		opts = strchr(line, '#');
+		if (opts)
+			*opts = 0;
+		line += strspn(line, " \t\r");
+		if (!*line) {
+			line = end;
+			continue;
+		}
+
+		opts = line + strcspn(line, " \t\r");
+		if (*opts)
+			*opts++ = 0;
+
+		if (spec_parse(line, &s)) {
+			ERROR("%s:%d: invalid group", group_file, lineno);
+			goto error;
+		}
+		if (spec_opts(&s, opts, lineno))
+			goto error;
+
+		/* continues the range of the line above */
+		if (first && addr_same(&s.grp, &next, 1) && s.source == source &&
+		    prof_same(&s.prof, &prof)) {
+			if (!spec_add(&s))
+				goto error;
+			num += s.num;
+		} else {
+			if (first && group_range(first, num))
+				goto error;
+
+			first = spec_add(&s);
+			if (!first)
+				goto error;
+			num    = s.num;
+			source = s.source;
+			prof   = s.prof;
+		}
+
+		next = first->grp;
+		addr_set_low(&next, addr_low(&next) + num);
+		total += s.num;
+		line = end;
+	}
+
+	if (first && group_range(first, num))
+		goto error;
+	free(buf);
+
+	DEBUG("Loaded %ld groups from %s", total, group_file);
+	return total;
+fail:
+	ERROR("Failed reading group file %s: %s", group_file, strerror(errno));
+error:
+	if (fd > STDIN_FILENO)
+		close(fd);
+	free(buf);
+	return -1;
+}
+
+static struct agg *agg_new(struct agg *parent, struct gr *first, size_t pos, size_t num)
+{
+	char buf[2 * INET_ADDRSTR_LEN + 24];
+	struct agg *a;
+
+	a = calloc(1, sizeof(*a));
+	if (!a)
+		return NULL;
+
+	snprintf(buf, sizeof(buf), "%s,%s+%zu", first->source ?: "*", first->group, num);
+	a->name = strdup(buf);
+	if (!a->name) {
+		free(a);
+		return NULL;
+	}
+
+	TAILQ_INIT(&a->sub);
+	a->parent = parent;
+	a->first  = first;
+	a->pos    = pos;
+	a->num    = num;
+
+	if (parent) {
+		TAILQ_INSERT_TAIL(&parent->sub, a, entry);
+		parent->nsub++;
+	} else {
+		TAILQ_INSERT_TAIL(&aggs, a, entry);
+		agg_num++;
+	}
+
+	return a;
+}
+
+/*
+ * Called after the num groups starting with first have been added, for
+ * the aggregate view.  The counters of a range and its blocks are updated
+ * along with the counters of each group, so the view never has to sum up
+ * all groups.
+ */
+int group_range(struct gr *first, size_t num)
+{
+	struct agg *range;
+	struct gr *g = first;
+	size_t pos, i, j;
+
+	pos = group_num - num;
+	range = agg_new(NULL, first, pos, num);
+	if (!range)
+		return 1;
+
+	for (i = 0; i < num; i += AGG_BLOCK) {
+		size_t len = num - i < AGG_BLOCK ? num - i : AGG_BLOCK;
+		struct agg *a = range;
+
+		if (num > AGG_BLOCK) {
+			a = agg_new(range, g, pos + i, len);
+			if (!a)
+				return 1;
+		}
+
+		for (j = 0; j < len; j++, g = TAILQ_NEXT(g, entry))
+			g->agg = a;
+	}
+
+	return 0;
+}
+
+/* History is only displayed by the plotters, sized to fit the screen */
+static size_t hist_size(void)
+{
+	size_t len = 1;
+
+	if (pres < 2)
+		return len;
+
+	while (len < (size_t)width && len < STATUS_HISTORY)
+		len <<= 1;
+
+	return len;
+}
+
+/* Allocate dense state of the groups added since last time */
+static int group_alloc(void)
+{
+	struct grstat *stats;
+	uint64_t *seen = NULL;
+	size_t words = DUP_WINDOW / 64;
+	size_t num = pending;
+	char *status;
+	struct gr *g;
+
+	if (!num)
+		return 0;
+
+	if ((errno = posix_memalign((void **)&stats, 64, num * sizeof(*stats))))
+		goto fail;
+	memset(stats, 0, num * sizeof(*stats));
+
+	status = malloc(num * hist_len);
+	if (!status)
+		goto fail;
+	memset(status, ' ', num * hist_len);
+
+	if (group_rx) {
+		if ((errno = posix_memalign((void **)&seen, 64, num * words * sizeof(*seen))))
+			goto fail;
+		memset(seen, 0, num * words * sizeof(*seen));
+	}
+
+	/* new groups are last, reused ones in between already have state */
+	TAILQ_FOREACH_REVERSE(g, &groups, gr_list, entry) {
+		size_t i;
+
+		if (g->st)
+			continue;
+
+		i = --pending;
+		g->st     = &stats[i];
+		g->status = &status[i * hist_len];
+		if (seen)
+			g->seen = &seen[i * words];
+		g->st->hcol = hist_now();
+		if (!pending)
+			break;
+	}
+
+	DEBUG("Allocated %zu groups, %zu bytes counters, %zu bytes history, %zu bytes bitmaps",
+	      num, num * sizeof(*stats), num * hist_len, seen ? num * words * sizeof(*seen) : 0);
+
+	return 0;
+fail:
+	ERROR("Failed allocating state for %zu groups: %s", num, strerror(errno));
+	return 1;
+}
+
+/* First group and position of each range and block, after removals */
+static void agg_fixup(void)
+{
+	struct agg *a, *b;
+	struct gr *g;
+	size_t i = 0;
+
+	TAILQ_FOREACH(a, &aggs, entry) {
+		a->first = NULL;
+		TAILQ_FOREACH(b, &a->sub, entry)
+			b->first = NULL;
+	}
+
+	TAILQ_FOREACH(g, &groups, entry) {
+		for (a = g->agg; a; a = a->parent) {
+			if (a->first)
+				break;
+			a->first = g;
+			a->pos   = i;
+		}
+		i++;
+	}
+
+	agg_dirty = 0;
+}
+
+/*
+ * Called when groups have been added or removed, also at runtime.
+ * Sets up the dense state of new groups.
+ */
+int group_commit(void)
+{
+	if (agg_dirty)
+		agg_fixup();
+
+	return group_alloc();
+}
+
+/*
+ * Set up the dense per-group state, when all groups have been added.
+ * Only a receiver needs the seqnos bitmaps for dup detection.
+ */
+int group_init(int rx)
+{
+	group_rx = rx;
+	hist_len = hist_size();
+
+	return group_commit();
+}
+
+static void top_remove(struct gr *g);
+
+/* Remove group from its aggregates, which are freed when empty */
+static void agg_del(struct gr *g)
+{
+	const struct grstat *st = g->st;
+	struct agg *a, *parent;
+
+	for (a = g->agg; a; a = parent) {
+		parent = a->parent;
+
+		if (st) {
+			a->count  -= st->count;
+			a->bytes  -= st->bytes;
+			a->lost   -= st->lost;
+			a->obytes -= g->obytes;
+		}
+		if (a->worst == g)
+			a->worst = NULL;
+		if (--a->num)
+			continue;
+
+		if (parent) {
+			TAILQ_REMOVE(&parent->sub, a, entry);
+			parent->nsub--;
+		} else {
+			TAILQ_REMOVE(&aggs, a, entry);
+			agg_num--;
+		}
+		free(a->name);
+		free(a);
+	}
+
+	agg_dirty = 1;
+}
+
+/*
+ * Remove a group, the caller has closed its socket.  Its state is kept
+ * for the next group added.  Call group_commit() when done.
+ */
+void group_del(struct gr *g)
+{
+	top_remove(g);
+	agg_del(g);
+
+	TAILQ_REMOVE(&groups, g, entry);
+	group_num--;
+	if (!g->st)
+		pending--;
+
+	if (g->group != g->gname)
+		free(g->group);
+	g->group  = NULL;
+	g->source = NULL;
+	g->agg    = NULL;
+
+	TAILQ_INSERT_TAIL(&unused, g, entry);
+}
+
+/* Remove groups of [SOURCE,]GROUP[:PORT][+NUM], cb is called before each */
+long group_leave(const char *arg, void (*cb)(struct gr *g))
+{
+	struct gr *g, *tmp;
+	struct spec s;
+	uint32_t low;
+	long num = 0;
+
+	if (spec_parse(arg, &s))
+		return -1;
+
+	low = addr_low(&s.grp);
+	TAILQ_FOREACH_SAFE(g, &groups, entry, tmp) {
+		uint32_t off = addr_low(&g->grp) - low;
+		inet_addr_t grp = s.grp;
+
+		if (off >= s.num || !g->source != !s.source)
+			continue;
+		if (s.source && !addr_same(&g->src, &s.src, 0))
+			continue;
+
+		/* same as the group at this offset of the range, and port */
+		addr_set_low(&grp, low + off);
+		if (!addr_same(&g->grp, &grp, 1))
+			continue;
+
+		if (cb)
+			cb(g);
+		group_del(g);
+		num++;
+	}
+	return num;
+}
+
+/* Zero all counters, the status history is kept */
+void group_reset(void)
+{
+	struct agg *a, *b;
+	struct gr *g;
+
+	TAILQ_FOREACH(g, &groups, entry) {
+		struct grstat *st = g->st;
+
+		st->bytes   = 0;
+		st->count   = 0;
+		st->gaps    = 0;
+		st->lost    = 0;
+		st->dupes   = 0;
+		st->order   = 0;
+		st->delayed = 0;
+		st->invalid = 0;
+		st->frags   = 0;
+		st->trunc   = 0;
+
+		top_remove(g);
+		g->obytes = 0;
+		g->rbytes = 0;
+		g->rate   = 0;
+		g->score  = 0;
+	}
+
+	TAILQ_FOREACH(a, &aggs, entry) {
+		TAILQ_FOREACH(b, &a->sub, entry) {
+			b->bytes = b->obytes = 0;
+			b->count = b->lost = b->rate = 0;
+			b->worst = NULL;
+		}
+		a->bytes = a->obytes = 0;
+		a->count = a->lost = a->rate = 0;
+		a->worst = NULL;
+	}
+}
+
+/*
+ * The worst groups are tracked with a min-heap of the TOP_MAX groups with
+ * the highest score, updated on every problem.  Recent problems weigh
+ * more: the weight doubles every TOP_HALFLIFE, which is the same as all
+ * older scores decaying, without having to touch them.  Scores only ever
+ * grow, so a group not in the heap can never have a higher score than the
+ * root.  When the weight grows too large all scores are scaled down,
+ * which keeps their order.
+ */
+static size_t top_shift(void)
+{
+	size_t half = TOP_HALFLIFE / period;
+
+	if (!half)
+		half = 1;
+
+	return htick / half - top_base;
+}
+
+static void top_renorm(void)
+{
+	struct gr *g;
+
+	TAILQ_FOREACH(g, &groups, entry)
+		g->score >>= TOP_RENORM;
+	top_base += TOP_RENORM;
+}
+
+static void top_swap(size_t a, size_t b)
+{
+	struct gr *g = top[a];
+
+	top[a] = top[b];
+	top[b] = g;
+	top[a]->top = a + 1;
+	top[b]->top = b + 1;
+}
+
+static void top_up(size_t i)
+{
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+
+		if (top[parent]->score <= top[i]->score)
+			break;
+		top_swap(i, parent);
+		i = parent;
+	}
+}
+
+static void top_down(size_t i)
+{
+	while (1) {
+		size_t l = 2 * i + 1, r = l + 1, min = i;
+
+		if (l < top_num && top[l]->score < top[min]->score)
+			min = l;
+		if (r < top_num && top[r]->score < top[min]->score)
+			min = r;
+		if (min == i)
+			break;
+		top_swap(i, min);
+		i = min;
+	}
+}
+
+static void top_remove(struct gr *g)
+{
+	size_t i = g->top - 1;
+
+	if (!g->top)
+		return;
+
+	g->top = 0;
+	if (i == --top_num)
+		return;
+
+	top[i] = top[top_num];
+	top[i]->top = i + 1;
+	top_up(i);
+	top_down(i);
+}
+
+/* Called on problems, num is the number of packets lost, or 1 */
+void top_update(struct gr *g, size_t num)
+{
+	size_t shift = top_shift();
+	struct agg *a;
+
+	while (shift >= TOP_RENORM) {
+		top_renorm();
+		shift -= TOP_RENORM;
+	}
+
+	g->score += (uint64_t)num << shift;
+	for (a = g->agg; a; a = a->parent) {
+		if (!a->worst || g->score > a->worst->score)
+			a->worst = g;
+	}
+
+	if (g->top) {
+		top_down(g->top - 1);
+		return;
+	}
+
+	if (top_num < TOP_MAX) {
+		top[top_num++] = g;
+		g->top = top_num;
+		top_up(top_num - 1);
+		return;
+	}
+
+	if (g->score <= top[0]->score)
+		return;
+
+	top[0]->top = 0;
+	top[0] = g;
+	g->top = 1;
+	top_down(0);
+}
+
+/* Score in number of recent problems */
+uint64_t top_recent(const struct gr *g)
+{
+	size_t shift = top_shift();
+
+	if (shift >= 64)
+		return 0;
+
+	return g->score >> shift;
+}
+
+static int top_cmp(const void *a, const void *b)
+{
+	const struct gr *ga = *(struct gr * const *)a;
+	const struct gr *gb = *(struct gr * const *)b;
+
+	if (ga->score == gb->score)
+		return 0;
+
+	return ga->score < gb->score ? 1 : -1;
+}
+
+/* Worst groups, worst first, in list of max entries */
+size_t top_list(struct gr **list, size_t max)
+{
+	struct gr *sorted[TOP_MAX];
+
+	memcpy(sorted, top, top_num * sizeof(*top));
+	qsort(sorted, top_num, sizeof(*top), top_cmp);
+
+	if (max > top_num)
+		max = top_num;
+	memcpy(list, sorted, max * sizeof(*list));
+
+	return max;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -32,9 +32,24 @@
 
 #include "log.h"
 #include "mcjoin.h"
+#include "pev.h"
 #include "screen.h"
 
-char **log_buf;			/* Ring buffer of LOG_MAX entries of width length */
+/*
+ * In UI mode the log is a ring of log_max lines, log_width long, and
+ * their timestamps.  Appending a line is O(1), timestamps are formatted
+ * when drawn, and the log window is redrawn at most once per frame.
+ */
+static char   *log_buf;
+static time_t *log_time;
+static int     log_head;	/* next line to write */
+static int     log_num;		/* lines in ring */
+static int     log_back;	/* lines scrolled back from newest */
+static int     log_dirty;
+static int     log_tid = -1;	/* one-shot redraw timer */
+
+static struct log_site *log_sites;	/* sites with suppressed messages */
+static int     log_rtid = -1;	/* one-shot summary timer */
 
 #ifdef SYSV			/* Only SVR4, the BSD's and Linux have it */
 #define INTERNAL_INVPRI 0x00	/* Value to indicate no priority in f_pmask */
@@ -66,19 +81,17 @@ CODE prioritynames[] = {
 };
 #endif /* SYSV */
 
-static int log_pri   = LOG_NOTICE;
+int        log_pri    = LOG_NOTICE;
+void     (*log_tap)(const char *msg);	/* copy of all messages, see ctrl.c */
 static int log_syslog = 0;
 static int log_ui     = 0;
 static int log_max    = 0;
 static int log_width  = 0;
-static int log_offset = 0;
 static int log_opts   = LOG_NDELAY | LOG_PID;
 
 int log_init(int fg, char *ident)
 {
 	if (fg) {
-		int i;
-
 		if (pres == 1)
 			return 0;
 
@@ -89,20 +102,14 @@ int log_init(int fg, char *ident)
 		if (log_width < 256)
 			log_width = 256;
 
-		log_scroll(0);	/* reset to lwh */
+		log_scroll(0);	/* reset to newest */
 
-		log_buf = calloc(log_max, sizeof(char *));
-		if (!log_buf)
+		log_buf  = calloc(log_max, log_width);
+		log_time = calloc(log_max, sizeof(time_t));
+		if (!log_buf || !log_time) {
+			free(log_buf);
+			free(log_time);
 			return -1;
-
-		for (i = 0; i < log_max; i++) {
-			log_buf[i] = calloc(log_width, sizeof(char));
-			if (!log_buf[i]) {
-				while (i)
-					free(log_buf[--i]);
-				free(log_buf);
-				return -1;
-			}
 		}
 
 		log_ui = 1;
@@ -117,15 +124,40 @@ int log_init(int fg, char *ident)
 	return 0;
 }
 
-int log_exit(void)
+static void log_cb(int id, void *arg)
 {
-	if (!foreground) {
-		int i;
+	(void)id;
+	(void)arg;
 
-		for (i = 0; i < log_max; i++)
-			free(log_buf[i]);
-		if (log_buf)
-			free(log_buf);
+	if (log_dirty)
+		log_show(0);
+}
+
+static void log_rate_cb(int id, void *arg);
+
+/* Called when the event loop is set up, for batched log redraws */
+int log_start(void)
+{
+	log_rtid = pev_timer_add(1000000, 0, log_rate_cb, NULL);
+	if (log_rtid < 0)
+		return -1;
+
+	if (!log_ui)
+		return 0;
+
+	log_tid = pev_timer_add(FRAME_PERIOD, 0, log_cb, NULL);
+	if (log_tid < 0)
+		return -1;
+
+	return 0;
+}
+
+int log_exit(void)
+{
+	if (log_ui) {
+		free(log_buf);
+		free(log_time);
+		log_ui = 0;
 
 		return 0;
 	}
@@ -177,84 +209,114 @@ int log_level(const char *level)
 void log_scroll(int updown)
 {
 	const int lwh = height - LOG_ROW; /* log window height */
-	const int bot = log_max - lwh;
-	const int top = 0;
+	const int top = log_num > lwh ? log_num - lwh : 0;
 
 	/* reset */
 	if (updown == 0) {
-		log_offset = bot;
+		log_back = 0;
 		return;
 	}
 
 	/* up/down, half-page increments */
-	log_offset += updown * lwh / 2;
+	log_back -= updown * lwh / 2;
 
-	if (log_offset < top)
-		log_offset = top;
-	if (log_offset > bot)
-		log_offset = bot;
+	if (log_back > top)
+		log_back = top;
+	if (log_back < 0)
+		log_back = 0;
 
 	log_show(0);
 }
 
+/* Line i of the ring, 0 is the oldest */
+static int log_line(int i)
+{
+	return (log_head - log_num + i + log_max) % log_max;
+}
+
 void log_show(int signo)
 {
+	const int lwh = height - LOG_ROW;
 	int y = LOG_ROW;
 	int i;
 
 	(void)signo;
 
+	log_dirty = 0;
 	if (help)
 		return;
 
 	gotoxy(0, LOGHEADING_ROW); /* Thu Nov  5 09:08:59 2020 */
 	clsdn();
-	fprintf(stderr, "\e[7m%-24s  Log%*s\e[0m\n", "Time", width - 29, " ");
+	scr_printf("\e[7m%-24s  Log%*s\e[0m\n", "Time", width - 29, " ");
 
-	for (i = log_offset; i < log_max; i++) {
-		char line[width];
+	i = log_num - lwh - log_back;
+	if (i < 0)
+		i = 0;
 
-		if (y >= height)
-			break;
+	for (; i < log_num && y < height; i++) {
+		int pos = log_line(i);
+		char line[width];
+		char ts[32];
+		struct tm tm;
 
-		if (strlen(log_buf[i]) < 2)
-			continue;
+		localtime_r(&log_time[pos], &tm);
+		strftime(ts, sizeof(ts), "%a %b %e %H:%M:%S %Y", &tm);
 
 		gotoxy(0, y++);
-		strlcpy(line, log_buf[i], sizeof(line));
-		fputs(line, stderr);
+		snprintf(line, sizeof(line), "%s  %s", ts, &log_buf[pos * log_width]);
+		scr_puts(line);
 	}
+	scr_flush();
 }
 
-int logit(int prio, char *fmt, ...)
+/* Append line to ring, the log window is redrawn by the next frame */
+static void log_append(const char *fmt, va_list ap)
 {
-	const char *snow;
-	va_list ap;
-	time_t now;
-	int rc = 0;
+	char *buf = &log_buf[log_head * log_width];
+	char *ptr;
 
-	va_start(ap, fmt);
-	if (log_syslog)
-		vsyslog(prio, fmt, ap);
-	else if (prio <= log_pri) {
-		if (log_ui) {
-			char buf[log_width];
-			char *ptr;
-			int i;
+	vsnprintf(buf, log_width, fmt, ap);
+	for (ptr = buf; *ptr && isspace((int)*ptr); ptr++)
+		;
+	if (ptr != buf)
+		memmove(buf, ptr, strlen(ptr) + 1);
 
-			for (i = 0; i < LOG_POS; i++)
-				strlcpy(log_buf[i], log_buf[i + 1], log_width);
+	log_time[log_head] = time(NULL);
+	log_head = (log_head + 1) % log_max;
+	if (log_num < log_max)
+		log_num++;
 
-			now = time(NULL);
-			snow = ctime(&now);
+	if (log_dirty)
+		return;
 
-			vsnprintf(buf, sizeof(buf), fmt, ap);
-			for (ptr = buf; *ptr && isspace((int)*ptr); ptr++)
-				;
+	log_dirty = 1;
+	if (log_tid > 0)
+		pev_timer_set(log_tid, FRAME_PERIOD);
+}
 
-			snprintf(log_buf[LOG_POS], log_width, "%24.24s  %s", snow, ptr);
-			log_show(0);
-		} else {
+static int vlogit(int prio, char *fmt, va_list ap)
+{
+	int rc = 0;
+
+	if (log_tap && prio <= log_pri) {
+		char msg[256];
+		va_list aq;
+
+		va_copy(aq, ap);
+		vsnprintf(msg, sizeof(msg), fmt, aq);
+		va_end(aq);
+		log_tap(msg);
+	}
+
+	if (prio > log_pri)
+		;		/* filtered before formatting */
+	else if (log_syslog)
+		vsyslog(prio, fmt, ap);
+	else {
+		if (log_ui)
+			log_append(fmt, ap);
+		else {
 			FILE *fp = stdout;
 			int sync = 0;
 
@@ -268,10 +330,100 @@ int logit(int prio, char *fmt, ...)
 				fflush(fp);
 		}
 	}
-	va_end(ap);
 
-	if (prio <= LOG_CRIT)
+	if (prio <= LOG_CRIT) {
+		if (log_ui)
+			log_show(0);
 		exit(1);
+	}
+
+	return rc;
+}
+
+int logit(int prio, char *fmt, ...)
+{
+	va_list ap;
+	int rc;
+
+	va_start(ap, fmt);
+	rc = vlogit(prio, fmt, ap);
+	va_end(ap);
+
+	return rc;
+}
+
+static void log_summary(struct log_site *site)
+{
+	logit(site->prio, "Suppressed %u similar messages\n", site->lost);
+	site->lost = 0;
+}
+
+/* Summarize sites that have been quiet since their last window */
+static void log_rate_cb(int id, void *arg)
+{
+	struct log_site **pp = &log_sites;
+	time_t now = time(NULL);
+
+	(void)id;
+	(void)arg;
+
+	while (*pp) {
+		struct log_site *site = *pp;
+
+		if (site->lost && site->when != now)
+			log_summary(site);
+
+		if (!site->lost) {
+			*pp = site->next;
+			site->next = NULL;
+			site->queued = 0;
+			continue;
+		}
+		pp = &site->next;
+	}
+
+	if (log_sites)
+		pev_timer_set(log_rtid, 1000000);
+}
+
+/*
+ * Rate limited logit(), for call sites that may fire for every packet,
+ * e.g., ERROR() when sendto() fails.  At most LOG_BURST messages per
+ * second and site are logged, the rest are only counted, without being
+ * formatted, and summarized when the next second starts.
+ */
+int logit_rl(struct log_site *site, int prio, char *fmt, ...)
+{
+	time_t now;
+	va_list ap;
+	int rc;
+
+	if (prio > log_pri)
+		return 0;
+
+	now = time(NULL);
+	if (site->when != now) {
+		if (site->lost)
+			log_summary(site);
+		site->when = now;
+		site->num  = 0;
+	}
+
+	if (site->num++ >= LOG_BURST) {
+		if (!site->lost++ && !site->queued) {
+			site->prio   = prio;
+			site->queued = 1;
+			site->next   = log_sites;
+			log_sites    = site;
+			if (log_rtid > 0)
+				pev_timer_set(log_rtid, 1000000);
+		}
+		return 0;
+	}
+
+	va_start(ap, fmt);
+	rc = vlogit(prio, fmt, ap);
+	va_end(ap);
 
 	return rc;
 }
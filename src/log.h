@@ -18,17 +18,64 @@
 #define MCJOIN_LOG_H_
 
 #include <syslog.h>
+#include <time.h>
 #include "mcjoin.h"
 
 #define LOG_MAX  (height - (int)LOG_ROW < 1 ? 1 : height - (int)LOG_ROW)
-#define LOG_POS  (log_max - 1)
+
+#define LOG_BURST 10		/* Max messages per second from one ERROR() */
+
+/* State of a rate limited call site */
+struct log_site {
+	struct log_site *next;	/* on list of sites with suppressed messages */
+	time_t        when;	/* current second */
+	unsigned int  num;	/* messages this second */
+	unsigned int  lost;	/* suppressed messages */
+	int           prio;
+	int           queued;
+};
+
+/*
+ * Per-packet debug messages are in trace categories, which can be left
+ * out at build time, e.g. CPPFLAGS=-DTRACE_MASK=TRACE_XDP, or all with
+ * configure --disable-trace.
+ */
+#define TRACE_PKT   0x01	/* Each packet sent/received */
+#define TRACE_SEG   0x02	/* GSO/GRO segments and zerocopy buffers */
+#define TRACE_XDP   0x04	/* AF_XDP rings */
+#define TRACE_ALL   0xff
+
+#ifndef TRACE_MASK
+#define TRACE_MASK  TRACE_ALL
+#endif
+
+/* Level check before any arguments are evaluated */
+#define LOG_ON(prio) ((prio) <= log_pri)
 
 #define FATAL(fmt, args...) do { logit(LOG_CRIT,   fmt "\n", ##args); } while (0)
-#define ERROR(fmt, args...) do { logit(LOG_ERR,    fmt "\n", ##args); } while (0)
-#define DEBUG(fmt, args...) do { logit(LOG_DEBUG,  fmt "\n", ##args); } while (0)
-#define PRINT(fmt, args...) do { logit(LOG_NOTICE, fmt "\n", ##args); } while (0)
+#define ERROR(fmt, args...) do {					\
+		static struct log_site _site;				\
+		logit_rl(&_site, LOG_ERR, fmt "\n", ##args);		\
+	} while (0)
+#define DEBUG(fmt, args...) do {					\
+		if (__builtin_expect(LOG_ON(LOG_DEBUG), 0))		\
+			logit(LOG_DEBUG, fmt "\n", ##args);		\
+	} while (0)
+#define TRACE(cat, fmt, args...) do {					\
+		if ((TRACE_MASK & (cat)) &&				\
+		    __builtin_expect(LOG_ON(LOG_DEBUG), 0))		\
+			logit(LOG_DEBUG, fmt "\n", ##args);		\
+	} while (0)
+#define PRINT(fmt, args...) do {					\
+		if (LOG_ON(LOG_NOTICE))					\
+			logit(LOG_NOTICE, fmt "\n", ##args);		\
+	} while (0)
+
+extern int log_pri;
+extern void (*log_tap)(const char *msg);
 
 int  log_init  (int fg, char *ident);
+int  log_start (void);
 int  log_exit  (void);
 
 int  log_prio  (int prio);
@@ -38,5 +85,6 @@ void log_scroll(int updown);
 void log_show  (int signo);
 
 int  logit     (int prio, char *fmt, ...);
+int  logit_rl  (struct log_site *site, int prio, char *fmt, ...);
 
 #endif /* MCJOIN_LOG_H_ */
@@ -0,0 +1,203 @@
+/* Read the shared memory stats of a running mcjoin, see mcjoin -S
+ *
+ * Copyright (c) 2008-2025  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm.h"
+
+#define REOPEN_TRIES 10		/* 100 msec apart, for a replaced segment */
+
+static char *ident = "mcjoin-stat";
+
+/* Copy record, retry while the writer is updating it */
+static void snapshot(const struct shm_group *r, struct shm_group *copy, size_t len)
+{
+	uint32_t seq;
+
+	while (1) {
+		seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		memcpy(copy, r, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+}
+
+static void show(const struct shm_hdr *hdr)
+{
+	const char *base = (const char *)hdr + hdr->hdr_size;
+	struct timespec now;
+	uint64_t i, usec;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	usec = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	usec -= __atomic_load_n(&hdr->updated, __ATOMIC_ACQUIRE);
+
+	printf("PID %" PRIu64 ", %s, %" PRIu64 " groups, updated %" PRIu64 " msec ago\n",
+	       hdr->pid, hdr->sender ? "sender" : "receiver", hdr->num, usec / 1000);
+	printf("%-34s %12s %10s %8s %8s %8s %8s %8s %8s %10s\n", "Source,Group", "Bytes",
+	       "Packets", "Gaps", "Lost", "Dupes", "Ordr", "Delay", "Invalid", "Rate");
+
+	for (i = 0; i < hdr->num; i++) {
+		const struct shm_group *r = (const void *)(base + i * hdr->rec_size);
+		struct shm_group st = { 0 };
+		char sg[2 * SHM_NAMELEN];
+
+		snapshot(r, &st, sizeof(st) < hdr->rec_size ? sizeof(st) : hdr->rec_size);
+		snprintf(sg, sizeof(sg), "%.*s,%.*s", SHM_NAMELEN, st.source, SHM_NAMELEN, st.group);
+		printf("%-34s %12" PRIu64 " %10" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64
+		       " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %9" PRIu64 "k\n", sg, st.bytes,
+		       st.count, st.gaps, st.lost, st.dupes, st.order, st.delayed, st.invalid,
+		       st.rate * 8 / 1000);
+	}
+}
+
+/* Map segment name, sets errno to EPROTO if it is not a valid one */
+static const struct shm_hdr *map(const char *name, size_t *len)
+{
+	const struct shm_hdr *hdr;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+
+	hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+		return NULL;
+
+	if ((size_t)st.st_size < sizeof(*hdr) ||
+	    __atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+	    hdr->version != SHM_VERSION ||
+	    hdr->hdr_size + hdr->num * hdr->rec_size > (uint64_t)st.st_size) {
+		munmap((void *)hdr, st.st_size);
+		errno = EPROTO;
+		return NULL;
+	}
+
+	*len = st.st_size;
+	return hdr;
+}
+
+/* Segment replaced by mcjoin when groups changed, open the new one */
+static const struct shm_hdr *reopen(const char *name, const struct shm_hdr *hdr, size_t *len)
+{
+	int i;
+
+	munmap((void *)hdr, *len);
+	for (i = 0; i < REOPEN_TRIES; i++) {
+		hdr = map(name, len);
+		if (hdr || (errno != ENOENT && errno != EPROTO))
+			break;
+		usleep(100000);
+	}
+
+	return hdr;
+}
+
+static int usage(int code)
+{
+	printf("Usage: %s [-h] [-i SEC] NAME\n"
+	       "Options:\n"
+	       "  -h          This help text\n"
+	       "  -i SEC      Show stats every SEC seconds, until mcjoin exits\n"
+	       "\n"
+	       "Show stats of a running mcjoin, started with -S NAME.\n", ident);
+
+	return code;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct shm_hdr *hdr;
+	int interval = 0;
+	size_t len;
+	char *name;
+	int c;
+
+	while ((c = getopt(argc, argv, "hi:")) != EOF) {
+		switch (c) {
+		case 'h':
+			return usage(0);
+
+		case 'i':
+			interval = atoi(optarg);
+			break;
+
+		default:
+			return usage(1);
+		}
+	}
+
+	if (optind >= argc)
+		return usage(1);
+
+	name = argv[optind];
+	hdr = map(name, &len);
+	if (!hdr)
+		goto fail;
+
+	while (1) {
+		show(hdr);
+		if (!interval || kill(hdr->pid, 0))
+			break;
+		sleep(interval);
+		puts("");
+
+		if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC) {
+			hdr = reopen(name, hdr, &len);
+			if (!hdr)
+				goto fail;
+		}
+	}
+
+	return 0;
+fail:
+	if (errno == EPROTO)
+		fprintf(stderr, "%s: %s is not an mcjoin stats segment\n", ident, name);
+	else
+		fprintf(stderr, "%s: cannot open %s: %s\n", ident, name, strerror(errno));
+	return 1;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -33,7 +33,6 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/socket.h>
-#include <sys/resource.h>
 
 #include "addr.h"
 #include "inetaddr.h"
@@ -49,12 +48,17 @@ int debug = 0;
 int hastty = 1;
 int duplicate = 0;		/* duplicate seqnos as sender, for testing */
 int foreground = 1;
+int xdp = 0;			/* AF_XDP engine instead of sockets */
+int offload = 0;		/* UDP GSO when sending, GRO when receiving */
+int zerocopy = 0;		/* MSG_ZEROCOPY when sending */
+int hdronly = 0;		/* Only read payload header when receiving */
 
 /* Global data */
 int period = 100000;		/* 100 msec in micro seconds*/
 int width = 80;
 int height = 24;
-size_t bytes = 100;
+size_t bytes = 0;		/* sender default DEFAULT_BYTES, receiver any */
+size_t burst = 1;
 size_t count = 0;
 int port = DEFAULT_PORT;
 unsigned char ttl = 1;
@@ -66,6 +70,8 @@ int need6 = 0;
 
 struct gr_list groups = TAILQ_HEAD_INITIALIZER(groups);
 size_t group_num = 0;
+int group_rows = 0;		/* visible groups, see view_resize() */
+size_t htick = 0;		/* current period */
 
 char iface[IFNAMSIZ];
 
@@ -78,7 +84,7 @@ static char spin(struct gr *g)
 
 	/* spin on activity only */
 	act = spinner[g->spin % num];
-	if (g->status[STATUS_POS] == '.')
+	if (hist_status(g, hist_now()) == '.')
 		g->spin++;
 
 	return act;
@@ -95,19 +101,27 @@ void progress_show(int signo)
 		return;
 
 	TAILQ_FOREACH(g, &groups, entry) {
-		if (g->status[STATUS_POS] != ' ')
-			act = g->status[STATUS_POS];
+		char st = hist_status(g, hist_now());
+
+		if (st != ' ' && st != '-')
+			act = st;
 	}
 
 	if (act)
 		progress();
 }
 
+static int wmax = -1;
+
+/* Width of the widest (S,G), only done again when groups change */
 static int sgwidth(void)
 {
 	struct gr *g;
-	int wmax = 0;
 
+	if (wmax >= 0)
+		return wmax;
+
+	wmax = 0;
 	TAILQ_FOREACH(g, &groups, entry) {
 		int w;
 
@@ -119,37 +133,135 @@ static int sgwidth(void)
 	return wmax;
 }
 
+/*
+ * The group view is a window of group_rows groups, starting at view_top,
+ * the rest of the screen is for the log.  Only visible groups are drawn,
+ * and paging walks the list from the current position, so the cost does
+ * not depend on the number of groups.
+ */
+static struct gr *view_top;
+static size_t     view_pos;		/* index of view_top */
+
+static void view_resize(void)
+{
+	int rows = height - GROUP_ROW - LOG_MIN;
+
+	if (rows < 1)
+		rows = 1;
+	if ((size_t)rows > group_num)
+		rows = group_num;
+
+	group_rows = rows;
+}
+
+/* Scroll group view num rows, negative is up, keeping a full page */
+static void view_scroll(long num)
+{
+	size_t bot = group_num - group_rows;
+
+	if (!view_top)
+		view_top = TAILQ_FIRST(&groups);
+
+	if (num < 0 && (size_t)-num > view_pos)
+		num = -(long)view_pos;
+	if (num > 0 && view_pos + num > bot)
+		num = view_pos < bot ? (long)(bot - view_pos) : 0;
+	if (num == 0 && view_pos > bot)
+		num = -(long)(view_pos - bot);
+
+	for (; num > 0; num--, view_pos++)
+		view_top = TAILQ_NEXT(view_top, entry);
+	for (; num < 0; num++, view_pos--)
+		view_top = TAILQ_PREV(view_top, gr_list, entry);
+}
+
+static void view_home(void)
+{
+	view_top = TAILQ_FIRST(&groups);
+	view_pos = 0;
+}
+
+static void view_end(void)
+{
+	view_home();
+	view_scroll(group_num);
+}
+
+/* Show position in heading at column x, if more groups than fit */
+static void view_range(int x, int room)
+{
+	char buf[64];
+	int len;
+
+	if ((size_t)group_rows >= group_num)
+		return;
+
+	len = snprintf(buf, sizeof(buf), "%zu-%zu of %zu", view_pos + 1,
+		       view_pos + group_rows, group_num);
+	if (len > room)
+		return;
+
+	gotoxy(x, HEADING_ROW);
+	scr_printf("\e[7m%s\e[0m", buf);
+}
+
+/* Iterate over visible groups */
+#define VIEW_FOREACH(g, i)						\
+	for (view_scroll(0), g = view_top, i = 0;			\
+	     g && i < (size_t)group_rows; g = TAILQ_NEXT(g, entry), i++)
+
+/*
+ * Show the last swidth columns of the status history, oldest first, with
+ * blanks for columns without updates and gaps.
+ */
+static void history_show(struct gr *g, int swidth)
+{
+	char buf[STATUS_HISTORY];
+	size_t col = hist_now() - swidth + 1;
+	int i;
+
+	for (i = 0; i < swidth; i++) {
+		char st = hist_status(g, col + i);
+
+		buf[i] = st == '-' ? ' ' : st;
+	}
+	scr_write(buf, swidth);
+}
+
 void plotter_show(int signo)
 {
 	struct gr *g;
 	int swidth;
 	int sgmax;
-	int spos;
-	size_t i = 0;
+	size_t i;
 
 	(void)signo;
 	sgmax  = sgwidth();
 	sgmax += 2;
 
 	gotoxy(0, HEADING_ROW);
-	fprintf(stderr, "\e[K\e[7m%-*s  Plotter%*s %8s\e[0m",
+	scr_printf("\e[K\e[7m%-*s  Plotter%*s %8s\e[0m",
 		sgmax, "Source,Group",
 		width - (sgmax + 18), " ",
 		"Packets");
-	swidth = width - (sgmax + 12);
+	view_range(sgmax + 11, width - (sgmax + 20));
+	swidth = width - (sgmax + 13);
 	if (swidth > STATUS_HISTORY)
 		swidth = STATUS_HISTORY;
-	spos = STATUS_HISTORY - swidth;
+	if (swidth < 0)
+		swidth = 0;
 
-	TAILQ_FOREACH(g, &groups, entry) {
+	VIEW_FOREACH(g, i) {
 		char sgbuf[35];
 		char act = 0;
 
-		gotoxy(0, GROUP_ROW + i++);
+		gotoxy(0, GROUP_ROW + i);
 		act = spin(g);
 
 		snprintf(sgbuf, sizeof(sgbuf), "%s,%s", g->source ? g->source : "*", g->group);
-		fprintf(stderr, "\e[K%-*s%c [%s] %8zu", sgmax, sgbuf, act, &g->status[spos], g->count);
+		scr_printf("\e[K%-*s%c [", sgmax, sgbuf, act);
+		history_show(g, swidth);
+		scr_printf("] %8zu", g->st->count);
 	}
 }
 
@@ -195,35 +307,37 @@ void plotbps_show(int signo)
 	struct gr *g;
 	int swidth;
 	int sgmax;
-	int spos;
-	size_t i = 0;
+	size_t i;
 
 	(void)signo;
 	sgmax  = sgwidth();
 	sgmax += 2;
 
 	gotoxy(0, HEADING_ROW);
-	fprintf(stderr, "\e[K\e[7m%-*s  Plotter%*s %6s %7s %8s\e[0m",
+	scr_printf("\e[K\e[7m%-*s  Plotter%*s %6s %7s %8s\e[0m",
 		sgmax, "Source,Group",
 		width - (sgmax + 33), " ",
 		"Rate",
 		"Bytes",
 		"Packets");
-	swidth = width - (sgmax + 27);
+	view_range(sgmax + 11, width - (sgmax + 35));
+	swidth = width - (sgmax + 28);
 	if (swidth > STATUS_HISTORY)
 		swidth = STATUS_HISTORY;
-	spos = STATUS_HISTORY - swidth;
+	if (swidth < 0)
+		swidth = 0;
 
-	TAILQ_FOREACH(g, &groups, entry) {
+	VIEW_FOREACH(g, i) {
 		char sgbuf[35];
 		char act = 0;
 
-		gotoxy(0, GROUP_ROW + i++);
+		gotoxy(0, GROUP_ROW + i);
 		act = spin(g);
 
 		snprintf(sgbuf, sizeof(sgbuf), "%s,%s", g->source ? g->source : "*", g->group);
-		fprintf(stderr, "\e[K%-*s%c [%s] %6s %7s %8zu", sgmax, sgbuf, act,
-			&g->status[spos], ratef(g->rate), bytef(g->bytes), g->count);
+		scr_printf("\e[K%-*s%c [", sgmax, sgbuf, act);
+		history_show(g, swidth);
+		scr_printf("] %6s %7s %8zu", ratef(g->rate), bytef(g->st->bytes), g->st->count);
 	}
 }
 
@@ -231,37 +345,214 @@ void stats_show(int signo)
 {
 	struct gr *g;
 	int sgmax;
-	size_t i = 0;
+	size_t i;
 	int w;
 
 	(void)signo;
 	sgmax  = sgwidth();
 	sgmax += 2;
 
-	w = width - (sgmax + 41);
+	w = width - (sgmax + 51);
 	if (w < 0)
 		w = 0;
 
 	gotoxy(0, HEADING_ROW);
-	fprintf(stderr, "\e[K\e[7m%-*s%*s%4s %4s %4s %4s %4s %7s %8s\e[0m",
+	scr_printf("\e[K\e[7m%-*s%*s%4s %4s %4s %4s %4s %4s %4s %7s %8s\e[0m",
 		sgmax, "Source,Group", w, " ",
-		"Inv", "Del", "Gaps", "Ordr", "Dups", "Bytes", "Packets");
+		"Inv", "Del", "Gaps", "Ordr", "Dups", "Frag", "Trnc", "Bytes", "Packets");
+	view_range(sgmax + 2, w - 2);
 
-	TAILQ_FOREACH(g, &groups, entry) {
+	VIEW_FOREACH(g, i) {
+		char sgbuf[35];
+
+		gotoxy(0, GROUP_ROW + i);
+
+		snprintf(sgbuf, sizeof(sgbuf), "%s,%s", g->source ? g->source : "*", g->group);
+		scr_printf("\e[K%-*s%*s%4zu %4zu %4zu %4zu %4zu %4zu %4zu %7s %8zu", sgmax, sgbuf,
+			w, " ", g->st->invalid, g->st->delayed, g->st->gaps, g->st->order, g->st->dupes,
+			g->st->frags, g->st->trunc, bytef(g->st->bytes), g->st->count);
+	}
+}
+
+/* like stats_show(), but only the groups with most recent problems */
+void worst_show(int signo)
+{
+	struct gr *list[TOP_MAX];
+	size_t i, num;
+	int sgmax;
+	int w;
+
+	(void)signo;
+	sgmax  = sgwidth();
+	sgmax += 2;
+
+	w = width - (sgmax + 56);
+	if (w < 0)
+		w = 0;
+
+	gotoxy(0, HEADING_ROW);
+	scr_printf("\e[K\e[7m%-*s%*s%4s %4s %4s %4s %4s %4s %4s %4s %7s %8s\e[0m",
+		sgmax, "Source,Group", w, " ", "Rcnt",
+		"Inv", "Del", "Gaps", "Ordr", "Dups", "Frag", "Trnc", "Bytes", "Packets");
+	if (w >= 7) {
+		gotoxy(sgmax + 2, HEADING_ROW);
+		scr_printf("\e[7mWorst\e[0m");
+	}
+
+	num = top_list(list, group_rows < TOP_MAX ? group_rows : TOP_MAX);
+	for (i = 0; i < (size_t)group_rows; i++) {
+		struct gr *g;
 		char sgbuf[35];
 
-		gotoxy(0, GROUP_ROW + i++);
+		gotoxy(0, GROUP_ROW + i);
+		if (i >= num) {
+			scr_puts("\e[K");
+			continue;
+		}
 
+		g = list[i];
 		snprintf(sgbuf, sizeof(sgbuf), "%s,%s", g->source ? g->source : "*", g->group);
-		fprintf(stderr, "\e[K%-*s%*s%4zu %4zu %4zu %4zu %4zu %7s %8zu", sgmax, sgbuf,
-			w, " ", g->invalid, g->delayed, g->gaps, g->order, g->dupes,
-			bytef(g->bytes), g->count);
+		scr_printf("\e[K%-*s%*s%4zu %4zu %4zu %4zu %4zu %4zu %4zu %4zu %7s %8zu", sgmax, sgbuf,
+			w, " ", (size_t)top_recent(g), g->st->invalid, g->st->delayed, g->st->gaps,
+			g->st->order, g->st->dupes, g->st->frags, g->st->trunc, bytef(g->st->bytes),
+			g->st->count);
+	}
+}
+
+/*
+ * The aggregate view lists all ranges, one per GROUP+NUM argument, or the
+ * blocks of one large range.  Enter drills down to the blocks of a range,
+ * or to the groups of a block in the stats view, Backspace goes back up.
+ */
+static struct agg *agg_cur;		/* range shown, NULL for all */
+static size_t      agg_sel;		/* selected row */
+static size_t      agg_off;		/* first row shown */
+
+static struct agg_list *agg_list(void)
+{
+	return agg_cur ? &agg_cur->sub : &aggs;
+}
+
+static size_t agg_rows(void)
+{
+	return agg_cur ? agg_cur->nsub : agg_num;
+}
+
+static struct agg *agg_nth(size_t n)
+{
+	struct agg *a;
+
+	TAILQ_FOREACH(a, agg_list(), entry) {
+		if (!n--)
+			break;
+	}
+
+	return a;
+}
+
+/* Move selection num rows, negative is up, scrolling to keep it visible */
+static void agg_scroll(long num)
+{
+	size_t rows = agg_rows();
+
+	if (num < 0 && (size_t)-num > agg_sel)
+		agg_sel = 0;
+	else if (num > 0 && agg_sel + num >= rows)
+		agg_sel = rows ? rows - 1 : 0;
+	else
+		agg_sel += num;
+
+	if (agg_sel < agg_off)
+		agg_off = agg_sel;
+	if (agg_sel >= agg_off + group_rows)
+		agg_off = agg_sel - group_rows + 1;
+}
+
+static void agg_enter(void)
+{
+	struct agg *a;
+
+	a = agg_nth(agg_sel);
+	if (!a)
+		return;
+
+	if (a->nsub) {
+		agg_cur = a;
+		agg_sel = agg_off = 0;
+	} else {
+		view_top = a->first;
+		view_pos = a->pos;
+		pres = 4;
+	}
+}
+
+static void agg_leave(void)
+{
+	struct agg *a = agg_cur, *b;
+
+	if (!a)
+		return;
+
+	agg_cur = a->parent;
+	agg_sel = agg_off = 0;
+	TAILQ_FOREACH(b, agg_list(), entry) {
+		if (b == a)
+			break;
+		agg_sel++;
+	}
+	agg_scroll(0);
+}
+
+void agg_show(int signo)
+{
+	struct agg *a;
+	int nmax = 14;
+	size_t i;
+	int w;
+
+	(void)signo;
+	agg_scroll(0);
+
+	a = agg_nth(agg_off);
+	for (i = 0; a && i < (size_t)group_rows; a = TAILQ_NEXT(a, entry), i++) {
+		int len = (int)strlen(a->name) + 2;
+
+		if (len > nmax)
+			nmax = len;
+	}
+
+	w = width - (nmax + 41);
+	if (w < 0)
+		w = 0;
+
+	gotoxy(0, HEADING_ROW);
+	scr_printf("\e[K\e[7m%-*s%6s %6s %7s %8s %6s  %-*s\e[0m",
+		nmax, agg_cur ? agg_cur->name : "Range", "Groups", "Rate", "Bytes",
+		"Packets", "Lost", w, "Worst");
+
+	a = agg_nth(agg_off);
+	for (i = 0; i < (size_t)group_rows; i++) {
+		const char *worst = "";
+
+		gotoxy(0, GROUP_ROW + i);
+		if (!a) {
+			scr_puts("\e[K");
+			continue;
+		}
+
+		if (a->worst)
+			worst = a->worst->group;
+
+		scr_printf("\e[K%s%-*s%6zu %6s %7s %8zu %6zu  %-*.*s\e[0m",
+			agg_off + i == agg_sel ? "\e[7m" : "", nmax, a->name, a->num,
+			ratef(a->rate), bytef(a->bytes), a->count, a->lost, w, w, worst);
+		a = TAILQ_NEXT(a, entry);
 	}
 }
 
 /*
  * Depending on presentation mode, either old-style dot progress,
- * new-style plotter, or new stats-view.
+ * new-style plotter, new stats-view, the worst groups, or aggregates.
  */
 void present(int signo)
 {
@@ -282,9 +573,18 @@ void present(int signo)
 		stats_show(signo);
 		break;
 
-	default:
+	case 5:
+		worst_show(signo);
 		break;
+
+	case 6:
+		agg_show(signo);
+		break;
+
+	default:
+		return;
 	}
+	scr_flush();
 }
 
 static char *uptime(time_t up)
@@ -337,13 +637,15 @@ static void show_stats(void)
 		char buf[35];
 
 		snprintf(buf, sizeof(buf), "%s,%s", g->source ? g->source : "*", g->group);
-		PRINT("%-*s: invalid %-5zu delay %-5zu gaps %-5zu reorder %-5zu dupes %-5zu bytes %-13zu packets %-8zu",
-		      len, buf, g->invalid, g->delayed, g->gaps, g->order, g->dupes, g->bytes, g->count);
-		total_count += g->count;
+		PRINT("%-*s: invalid %-5zu delay %-5zu gaps %-5zu reorder %-5zu dupes %-5zu frags %-5zu trunc %-5zu bytes %-13zu packets %-8zu",
+		      len, buf, g->st->invalid, g->st->delayed, g->st->gaps, g->st->order, g->st->dupes, g->st->frags, g->st->trunc, g->st->bytes, g->st->count);
+		total_count += g->st->count;
 	}
 	PRINT("\nTotal: %zu packets", total_count);
+	churn_show();
 
 	now = time(NULL);
+	sizes_show(now - start);
 	PRINT("Uptime: %s", uptime(now - start));
 }
 
@@ -355,11 +657,14 @@ static void help_show(void)
 		NULL
 	};
 	const char *keys[] = {
+		"a - Toggle aggregate view  Enter/BkSp - Drill down/up ranges",
 		"d - Toggle frame duplication    PgUp - Scroll log view up",
 		"h - Toggle this help text       PgDn - Scroll log view down",
-		"l - Toggle debug log          Ctrl-L - Refresh display",
+		"l - Toggle debug log          Up/Dn  - Scroll groups one line",
+		"n - Next page of groups     Home/End - First/last group",
+		"p - Previous page of groups   Ctrl-L - Refresh display",
 		"q - Quit mcjoin               Ctrl-C - Quit mcjoin",
-		"t - Toggle viewing modes",
+		"t - Toggle viewing modes      w      - Toggle worst groups",
 		NULL
 	};
 	int i, w = 0;
@@ -375,36 +680,37 @@ static void help_show(void)
 	gotoxy(0, LOGHEADING_ROW);
 	clsdn();
 
-	fprintf(stderr, "\e[7mHelp%*s\e[0m\r\n", width - 4, " ");
-	fprintf(stderr, "\r\n");
+	scr_printf("\e[7mHelp%*s\e[0m\r\n", width - 4, " ");
+	scr_printf("\r\n");
 	for (i = 0; keys[i]; i++)
-		fprintf(stderr, "%*s%s\r\n", (width - w) / 2, " ", keys[i]);
+		scr_printf("%*s%s\r\n", (width - w) / 2, " ", keys[i]);
 
-	fprintf(stderr, "\e[4m%*s\e[0m\r\n", width, " ");
+	scr_printf("\e[4m%*s\e[0m\r\n", width, " ");
 	w = (int)(strlen(support[0]) + strlen(support[1]) + 3);
 	if (w > width) {
 		for (i = 0; support[i]; i++) {
 			w = strlen(support[i]);
-			fprintf(stderr, "%*s%s\r\n", (width - w) / 2, " ", support[i]);
+			scr_printf("%*s%s\r\n", (width - w) / 2, " ", support[i]);
 		}
 	} else
-		fprintf(stderr, "%*s%s | %s\r\n", (width - w) / 2, " ", support[0], support[1]);
+		scr_printf("%*s%s | %s\r\n", (width - w) / 2, " ", support[0], support[1]);
+	scr_flush();
 }
 
-static void prettyprint(FILE *fp, const char *str)
+static void prettyprint(const char *str)
 {
-	fputs("\e[2m", fp);
+	scr_puts("\e[2m");
 	while (*str) {
 		if (isupper(*str)) {
-			fputs("\e[0m\e[1m", fp);
-			fputc(*str, fp);
-			fputs("\e[0m\e[2m", fp);
+			scr_puts("\e[0m\e[1m");
+			scr_write(str, 1);
+			scr_puts("\e[0m\e[2m");
 		} else
-			fputc(*str, fp);
+			scr_write(str, 1);
 
 		str++;
 	}
-	fputs("\e[0m", fp);
+	scr_puts("\e[0m");
 }
 
 static void redraw(int signo)
@@ -415,19 +721,24 @@ static void redraw(int signo)
 	if (pres == 1 || !foreground)
 		return;
 
-	if (signo)
+	if (signo) {
 		ttsize(&width, &height);
+		scr_init(width, height);
+		view_resize();
+	}
 
-	if (!join)
+	if (attach_path)
+		title = join ? "mcjoin :: attached to receiver" : "mcjoin :: attached to sender";
+	else if (!join)
 		title = "mcjoin :: sending multicast";
 	else
 		title = "mcjoin :: receiving multicast";
 
 	cls();
 	gotoxy((width - strlen(title)) / 2, TITLE_ROW);
-	fprintf(stderr, "\e[1m%s\e[0m", title);
+	scr_printf("\e[1m%s\e[0m", title);
 	gotoxy((width - strlen(howto)) / 2, HOSTDATE_ROW);
-	prettyprint(stderr, howto);
+	prettyprint(howto);
 
 	if (signo) {
 		present(signo);
@@ -436,6 +747,18 @@ static void redraw(int signo)
 		else
 			log_show(signo);
 	}
+	scr_flush();
+}
+
+/* Groups added or removed at runtime, start over from the top */
+void view_update(void)
+{
+	wmax    = -1;
+	agg_cur = NULL;
+	agg_sel = agg_off = 0;
+	view_resize();
+	view_home();
+	redraw(1);
 }
 
 static void sigwinch_cb(int signo, void *arg)
@@ -463,6 +786,10 @@ static void deadline_cb(int id, void *arg)
 
 #define PG_UP 1
 #define PG_DN 2
+#define UP    3
+#define DOWN  4
+#define HOME  5
+#define END   6
 
 static int check_esc(int sd)
 {
@@ -475,10 +802,28 @@ static int check_esc(int sd)
 	if (read(sd, &ch, sizeof(ch)) != 1)
 		return -1;
 
-	if (ch == '5')
+	switch (ch) {
+	case 'A':
+		return UP;
+	case 'B':
+		return DOWN;
+	case 'H':
+		return HOME;
+	case 'F':
+		return END;
+	case '1':
+		rc = HOME;
+		break;
+	case '4':
+		rc = END;
+		break;
+	case '5':
 		rc = PG_UP;
-	if (ch == '6')
+		break;
+	case '6':
 		rc = PG_DN;
+		break;
+	}
 
 	if (read(sd, &ch, sizeof(ch)) != 1 || ch != '~')
 		return -1;
@@ -486,9 +831,23 @@ static int check_esc(int sd)
 	return rc;
 }
 
+/* Scroll group view, or move the selection in the aggregate view */
+static void view_move(long num)
+{
+	if (pres == 6)
+		agg_scroll(num);
+	else if (num == -(long)group_num)
+		view_home();
+	else if (num == (long)group_num)
+		view_end();
+	else
+		view_scroll(num);
+	present(0);
+}
+
 static void key_cb(int sd, void *arg)
 {
-	static int log_pri = -1;
+	static int saved_pri = -1;
 	char ch;
 
 	(void)arg;
@@ -509,14 +868,51 @@ static void key_cb(int sd, void *arg)
 				log_scroll(+1);
 				break;
 
+			case UP:
+				view_move(-1);
+				break;
+
+			case DOWN:
+				view_move(+1);
+				break;
+
+			case HOME:
+				view_move(-(long)group_num);
+				break;
+
+			case END:
+				view_move(group_num);
+				break;
+
 			default:
 				/* unhandled esc sequence */
 				break;
 			}
 			break;
 
+		case '\r':
+		case '\n':
+			if (pres == 6) {
+				agg_enter();
+				present(0);
+			}
+			break;
+
+		case '\b':
+		case 0x7f:
+			if (pres == 6) {
+				agg_leave();
+				present(0);
+			}
+			break;
+
+		case 'a':
+			pres = pres == 6 ? 2 : 6;
+			present(0);
+			break;
+
 		case 'd':
-			if (!join) {
+			if (!join && !attach_path) {
 				duplicate ^= 1;
 				PRINT("%s (%d) seqno duplication.", duplicate ? "Enabling" : "Disabling", duplicate);
 			}
@@ -530,13 +926,21 @@ static void key_cb(int sd, void *arg)
 				log_show(0);
 			break;
 
+		case 'n':
+			view_move(group_rows);
+			break;
+
+		case 'p':
+			view_move(-group_rows);
+			break;
+
 		case 'l':
-			if (log_pri == -1)
-				log_pri = log_level(NULL);
+			if (saved_pri == -1)
+				saved_pri = log_level(NULL);
 			if (log_level(NULL) != LOG_DEBUG)
 				log_prio(LOG_DEBUG);
 			else
-				log_prio(log_pri);
+				log_prio(saved_pri);
 			break;
 
 		case 'q':
@@ -545,12 +949,17 @@ static void key_cb(int sd, void *arg)
 
 		case 't':
 			pres++;
-			if (pres > 4)
+			if (pres > 6)
 				pres = 2;
 			else
 				present(0);
 			break;
 
+		case 'w':
+			pres = pres == 5 ? 2 : 5;
+			present(0);
+			break;
+
 		default:
 			DEBUG("Got char 0x%02x", ch);
 			break;
@@ -560,20 +969,17 @@ static void key_cb(int sd, void *arg)
 
 static void scroll_cb(int id, void *arg)
 {
-	struct gr *g;
-
 	(void)id;
 	(void)arg;
 
-	present(0);
-
-	/* age all groups */
-	TAILQ_FOREACH(g, &groups, entry) {
-		memmove(g->status, &g->status[1], STATUS_HISTORY - 1);
-		memmove(g->seqnos, &g->seqnos[1], (STATUS_HISTORY - 1) * sizeof(size_t));
-		g->status[STATUS_POS] = ' ';
-		g->seqnos[STATUS_POS] = 0;
+	/* at most one frame per FRAME_PERIOD, when a column is complete */
+	if (htick % hist_per == hist_per - 1) {
+		present(0);
+		ctrl_snapshot();
 	}
+
+	/* age all groups, stale columns are cleared on next update */
+	htick++;
 }
 
 static void clock_cb(int id, void *arg)
@@ -595,20 +1001,32 @@ static void clock_cb(int id, void *arg)
 	up = now - start;
 
 	gotoxy(0, HOSTDATE_ROW);
-	fprintf(stderr, "%s (%s@%s)", hostname, buf, iface);
+	scr_printf("%s (%s@%s)", hostname, buf, iface);
 
 	str = uptime(up);
 	gotoxy(width - strlen(str) + 1, TITLE_ROW);
-	fputs(str, stderr);
+	scr_puts(str);
 
 	str = ctime(&now);
 	gotoxy(width - strlen(str) + 2, HOSTDATE_ROW);
-	fputs(str, stderr);
+	scr_puts(str);
+	scr_flush();
+}
+
+static void agg_rate(struct agg *a, int freq)
+{
+	size_t rate;
+
+	rate = a->bytes - a->obytes;
+	if (rate)
+		a->rate = rate / freq;
+	a->obytes = a->bytes;
 }
 
 static void rate_cb(int id, void *arg)
 {
 	int freq = pev_timer_get(id);
+	struct agg *a, *b;
 	struct gr *g;
 
 	freq /= 1000000;	/* /sec */
@@ -617,44 +1035,109 @@ static void rate_cb(int id, void *arg)
 	TAILQ_FOREACH(g, &groups, entry) {
 		size_t rate;
 
-		rate = g->bytes - g->obytes;
+		rate = g->st->bytes - g->obytes;
 		if (rate)
 			g->rate = rate / freq;
-		g->obytes = g->bytes;
+		g->obytes = g->st->bytes;
+	}
+
+	TAILQ_FOREACH(a, &aggs, entry) {
+		agg_rate(a, freq);
+		TAILQ_FOREACH(b, &a->sub, entry)
+			agg_rate(b, freq);
 	}
 }
 
+/* Absolute path of a file, which may not exist yet, for after daemonize() */
+static char *abspath(const char *path)
+{
+	char *dir, *base, *real = NULL, *abs = NULL;
+	size_t len;
+
+	dir  = strdup(path);
+	base = strdup(path);
+	if (!dir || !base)
+		goto done;
+
+	real = realpath(dirname(dir), NULL);
+	if (!real)
+		goto done;
+
+	len = strlen(real) + strlen(path) + 2;
+	abs = malloc(len);
+	if (abs)
+		snprintf(abs, len, "%s/%s", real, basename(base));
+done:
+	free(real);
+	free(base);
+	free(dir);
+
+	return abs;
+}
+
 static int usage(int code)
 {
 	if (!iface[0])
 		ifdefault(iface, sizeof(iface));
 
-	printf("Usage: %s [-dhjosv] [-b BYTES] [-c COUNT] [-f MSEC ][-i IFACE] [-l LEVEL]\n"
-	       "              [-p PORT] [-t TTL] [-w SEC] [-W SEC]\n"
+	printf("Usage: %s [-dghHjosvxz] [-b BYTES] [-B NUM] [-c COUNT] [-C RATE[:random]] [-f MSEC]\n"
+	       "              [-F FILE] [-i IFACE] [-l LEVEL] [-M [ADDR:]PORT] [-p PORT] [-r FILE]\n"
+	       "              [-R SEC] [-S NAME] [-t TTL] [-u PATH] [-w SEC] [-W SEC]\n"
 	       "              [[SOURCE,]GROUP0[:PORT] .. [SOURCE,]GROUPN[:PORT] |\n"
-	       "               [SOURCE,]GROUP[:PORT]+NUM]\n"
+	       "               [SOURCE,]GROUP[:PORT]+NUM | /LEN | -LAST] [key=value ..]\n"
+	       "       %s -a PATH [-l LEVEL] [-W SEC]\n"
 	       "Options:\n"
-	       "  -b BYTES    Payload in bytes over IP/UDP header (42 bytes), default: 100\n"
+	       "  -a PATH     Attach to control socket PATH of a running mcjoin, and show\n"
+	       "              its groups and log, see -u\n"
+	       "  -b BYTES    Payload in bytes over IP/UDP header (42 bytes), default: %d\n"
+	       "              As receiver, largest expected payload, default: any\n"
+	       "  -B NUM      Burst, send NUM packets per group every period, default: 1\n"
 	       "  -c COUNT    Stop sending/receiving after COUNT number of packets (per group)\n"
+	       "  -C RATE     Churn, as receiver leave and re-join RATE groups/s, round-robin,\n"
+	       "              or with :random, show join/leave latencies at exit\n"
 	       "  -d          Run as daemon in background, output except progress to syslog\n"
 	       "  -f MSEC     Frequency, poll/send every MSEC milliseconds, default: %d\n"
+	       "  -F FILE     Read groups from FILE, or - for stdin, one per line, with\n"
+	       "              optional key=value options, like on the command line\n"
+	       "  -g          Use UDP GSO to send each burst with one syscall, and UDP GRO\n"
+	       "              to receive coalesced datagrams, Linux only\n"
 	       "  -h          This help text\n"
+	       "  -H          Header only, receive only the start of each datagram, the\n"
+	       "              rest is discarded by the kernel but counted in bytes\n"
 	       "  -i IFACE    Interface to use for sending/receiving multicast, default: %s\n"
 	       "  -j          Join groups, default unless acting as sender\n"
 	       "  -l LEVEL    Set log level; none, notice*, debug\n"
+	       "  -M PORT     Serve OpenMetrics of all groups over HTTP on [ADDR:]PORT,\n"
+	       "              for Prometheus, default ADDR: 127.0.0.1\n"
 	       "  -o          Old (plain/ordinary) output, no fancy progress bars\n"
 	       "  -p PORT     UDP port number to send/listen to, also possible to define\n"
 	       "              custom port per group (see above), default: %d\n"
+	       "  -r FILE     Write stats of all groups to FILE every interval, one record\n"
+	       "              per group and one with totals, CSV if FILE ends with .csv,\n"
+	       "              otherwise NDJSON\n"
+	       "  -R SEC      Interval for -r, default: 1\n"
 	       "  -s          Act as sender, sends packets to select groups, default: no\n"
+	       "  -S NAME     Publish stats of all groups in shared memory /dev/shm/NAME,\n"
+	       "              read with mcjoin-stat NAME\n"
 	       "  -t TTL      TTL to use when sending multicast packets, default: 1\n"
+	       "  -u PATH     Control socket, for clients attaching with -a PATH, e.g., to\n"
+	       "              watch an mcjoin started with -d, and for the commands:\n"
+	       "              join SPEC.., leave SPEC.., rate PPS, reset\n"
 	       "  -v          Display program version\n"
 	       "  -w SEC      Initial wait before opening sockets\n"
 	       "  -W SEC      Timeout, in seconds, before %s exits\n"
+	       "  -x          Use AF_XDP on queue 0 of IFACE, Linux only, falls back to\n"
+	       "              regular sockets if not available\n"
+	       "  -z          Use MSG_ZEROCOPY when sending, for large payloads, Linux only\n"
+	       "\n"
+	       "Options for the group before them, as key=value: port=PORT, source=ADDR,\n"
+	       "and as sender rate=PPS, size=BYTES, and burst=NUM, see mcjoin(1).  The\n"
+	       "size can also vary, size=imix, size=SIZE:WEIGHT,.., or size=FIRST-LAST/STEP\n"
 	       "\n"
 	       "Note: IPv6 addresses can be within actual [1:2:3:::1] or have to contain\n"
 	       "      more than one ':' to be differentiated from a custom port number.\n"
 	       "\n"
-	       "Bug report address : %-40s\n", ident, period / 1000, iface,
+	       "Bug report address : %-40s\n", ident, ident, DEFAULT_BYTES, period / 1000, iface,
 	       DEFAULT_PORT, ident, PACKAGE_BUGREPORT);
 #ifdef PACKAGE_URL
 	printf("Project homepage   : %s\n", PACKAGE_URL);
@@ -678,39 +1161,81 @@ static char *progname(char *arg0)
 
 int main(int argc, char *argv[])
 {
-	struct rlimit rlim;
-	struct gr *g;
+	char *ptr;
 	int deadline = 0;
 	int wait = 0;
-	int i, c, rc;
+	int c, rc;
 	size_t ilen;
 
 	ident = progname(argv[0]);
-	while ((c = getopt(argc, argv, "b:c:df:hi:jl:op:st:vw:W:")) != EOF) {
+	while ((c = getopt(argc, argv, "a:b:B:c:C:df:F:ghHi:jl:M:op:r:R:sS:t:u:vw:W:xz")) != EOF) {
 		switch (c) {
+		case 'a':
+			attach_path = optarg;
+			break;
+
 		case 'b':
-			bytes = (size_t)atoi(optarg);
-			if (bytes > BUFSZ) {
-				ERROR("Too long payload, max %d bytes", BUFSZ);
+			rc = atoi(optarg);
+			if (rc < 1 || rc > PAYLOAD_MAX) {
+				ERROR("Invalid payload size, 1-%d bytes", PAYLOAD_MAX);
 				return 1;
 			}
+			bytes = (size_t)rc;
+			break;
+
+		case 'B':
+			rc = atoi(optarg);
+			if (rc < 1) {
+				ERROR("Invalid burst: %s", optarg);
+				return 1;
+			}
+			burst = (size_t)rc;
 			break;
 
 		case 'c':
 			count = (size_t)atoi(optarg);
 			break;
 
+		case 'C':
+			churn_rate = strtod(optarg, &ptr);
+			if (!strcmp(ptr, ":random"))
+				churn_random = 1;
+			else if (*ptr)
+				churn_rate = 0;
+			if (churn_rate <= 0) {
+				ERROR("Invalid churn rate: %s", optarg);
+				return 1;
+			}
+			break;
+
 		case 'd':
 			foreground = 0;
 			break;
 
 		case 'f':
-			period = atoi(optarg) * 1000;
+			rc = atoi(optarg);
+			if (rc < 1) {
+				ERROR("Invalid frequency: %s", optarg);
+				return 1;
+			}
+			period = rc * 1000;
+			break;
+
+		case 'F':
+			group_file = optarg;
+			break;
+
+		case 'g':
+			offload = 1;
 			break;
 
 		case 'h':
 			return usage(0);
 
+		case 'H':
+			hdronly = 1;
+			break;
+
 		case 'i':
 			ilen = strlen(optarg);
 			if (ilen >= sizeof(iface)) {
@@ -732,6 +1257,10 @@ int main(int argc, char *argv[])
 			}
 			break;
 
+		case 'M':
+			metrics_addr = optarg;
+			break;
+
 		case 'o':
 			pres = 1;
 			break;
@@ -744,14 +1273,34 @@ int main(int argc, char *argv[])
 			}
 			break;
 
+		case 'r':
+			report_file = optarg;
+			break;
+
+		case 'R':
+			report_interval = atoi(optarg);
+			if (report_interval < 1) {
+				ERROR("Invalid stats interval: %s", optarg);
+				return 1;
+			}
+			break;
+
 		case 's':
 			join = 0;
 			break;
 
+		case 'S':
+			shm_name = optarg;
+			break;
+
 		case 't':
 			ttl = atoi(optarg);
 			break;
 
+		case 'u':
+			ctrl_path = optarg;
+			break;
+
 		case 'v':
 			printf("%s\n", PACKAGE_VERSION);
 			return 0;
@@ -764,22 +1313,58 @@ int main(int argc, char *argv[])
 			deadline = atoi(optarg);
 			break;
 
+		case 'x':
+			xdp = 1;
+			break;
+
+		case 'z':
+			zerocopy = 1;
+			break;
+
 		default:
 			return usage(1);
 		}
 	}
 
-	if (optind == argc) {
-		g = calloc(1, sizeof(*g));
-		if (!g)
-			FATAL("failed allocating group: %s", strerror(errno));
+	if (!join && !bytes)
+		bytes = DEFAULT_BYTES;
+	if (!join && bytes < PAYLOAD_MIN) {
+		ERROR("Invalid payload size, %d-%d bytes when sending", PAYLOAD_MIN, PAYLOAD_MAX);
+		return 1;
+	}
+
+	/* Short periods are aggregated, one history column per frame */
+	if (period < FRAME_PERIOD)
+		hist_per = (FRAME_PERIOD + period - 1) / period;
+
+	/* groups of an attached client are those of the data plane */
+	if (attach_path && (optind < argc || group_file))
+		return usage(1);
 
-		g->group = strdup(DEFAULT_GROUP);
-		TAILQ_INSERT_TAIL(&groups, g, entry);
-		group_num++;
+	if (churn_rate > 0 && (!join || attach_path)) {
+		ERROR("Group churn, -C, is only for receivers.");
+		return 1;
 	}
 
 	if (!foreground) {
+		char **paths[] = { &group_file, &report_file, &ctrl_path };
+		size_t i;
+
+		/* daemonize() changes directory to / */
+		for (i = 0; i < NELEMS(paths); i++) {
+			char *path;
+
+			if (!*paths[i])
+				continue;
+
+			path = abspath(*paths[i]);
+			if (!path) {
+				ERROR("Invalid path %s: %s", *paths[i], strerror(errno));
+				return 1;
+			}
+			*paths[i] = path;
+		}
+
 		if (daemonize())
 			FATAL("Failed backgrounding: %s", strerror(errno));
 		pres = 0;
@@ -801,169 +1386,40 @@ int main(int argc, char *argv[])
 	if (!iface[0])
 		ifdefault(iface, sizeof(iface));
 
+	if (attach_path && attach_init())
+		return 1;
+
+	if (group_load() < 0)
+		return 1;
+
+	if (optind == argc && !attach_path && !group_file && group_parse(DEFAULT_GROUP) < 0)
+		return 1;
+
 	/*
 	 * mcjoin group+num
 	 * mcjoin group0 group1 group2
+	 * mcjoin group0+num rate=pps size=bytes group1
 	 */
-	for (i = optind; i < argc; i++) {
-		char *pos, *group, *source = NULL;
-		char buf[2 * INET_ADDRSTR_LEN + 11];
-		int j, num = 1;
-
-		strlcpy(buf, argv[i], sizeof(buf));
-		pos = strchr(buf, '+');
-		if (pos) {
-			*pos = 0;
-			num = atoi(&pos[1]);
-		}
-		group = buf;
+	if (group_args(argc - optind, &argv[optind]) < 0)
+		return usage(1);
 
-		pos = strchr(group, ',');
-		if (pos) {
-			*pos++ = 0;
-			source = strdup(group);
-			group  = pos;
-		}
-
-		if (num < 1) {
-			ERROR("Invalid number of groups given (%d).", num);
-			return usage(1);
-		}
-
-		for (j = 0; j < num; j++) {
-#ifdef AF_INET6
-			struct sockaddr_in6 *sin6;
-#endif
-			struct sockaddr_in *sin;
-			inet_addr_t addr;
-			socklen_t len;
-			uint32_t step;
-			void *ptr;
-			int family;
-
-#ifdef AF_INET6
-			if (inet_ip6(group)) {
-				family = AF_INET6;
-				sin6 = (struct sockaddr_in6 *)&addr;
-				ptr = &sin6->sin6_addr;
-			} else
-#endif
-			{
-				family = AF_INET;
-				sin = (struct sockaddr_in *)&addr;
-				ptr = &sin->sin_addr;
-			}
-
-			DEBUG("Converting family %d group %s to ptr %p, num :%d ... ", family, group, ptr, num);
-			if (inet_pton_port(family, group, ptr, NULL, 0)) {
-				ERROR("%s is not a valid multicast group", group);
-				return usage(1);
-			}
-
-			DEBUG("Adding (S,G) %s,%s to list ...", source ?: "*", group);
-			g = calloc(1, sizeof(*g));
-			if (!g)
-				FATAL("failed allocating group: %s", strerror(errno));
-
-			g->source = source;
-			g->group = strdup(group);
-			TAILQ_INSERT_TAIL(&groups, g, entry);
-			group_num++;
-
-			/* Next group ... */
-#ifdef AF_INET6
-			if (inet_ip6(group)) {
-				memcpy(&step, &sin6->sin6_addr.s6_addr[12],
-				       sizeof(step));
-				step = htonl(ntohl(step) + 1);
-				memcpy(&sin6->sin6_addr.s6_addr[12], &step,
-				       sizeof(step));
-				len = sizeof(*sin6);
-			} else
-#endif
-			{
-				step = ntohl(sin->sin_addr.s_addr);
-				step++;
-				sin->sin_addr.s_addr = htonl(step);
-				len = sizeof(*sin);
-			}
-
-			inet_ntop(family, ptr, buf, len);
-			group = buf;
-		}
-	}
-
-	if (getrlimit(RLIMIT_NOFILE, &rlim)) {
-		ERROR("Failed reading RLIMIT_NOFILE");
+	/* Receiver has one socket per group, sender only one per family */
+	if (join && !attach_path && receiver_nofile(group_num))
 		return 1;
-	}
 
-	DEBUG("NOFILE: current %ld max %ld", rlim.rlim_cur, rlim.rlim_max);
-	rlim.rlim_cur = group_num + 10; /* Need stdio + pollfd, etc. */
-	if (setrlimit(RLIMIT_NOFILE, &rlim)) {
-		ERROR("Failed setting RLIMIT_NOFILE soft limit to %d", rlim.rlim_cur);
+	if (group_init(join && !attach_path))
 		return 1;
-	}
-	DEBUG("NOFILE: set new current %ld max %ld", rlim.rlim_cur, rlim.rlim_max);
-
-	TAILQ_FOREACH(g, &groups, entry) {
-#ifdef AF_INET6
-		if (inet_ip6(g->group)) {
-			struct sockaddr_in6 *grp = (struct sockaddr_in6 *)&g->grp;
-			struct sockaddr_in6 *src = (struct sockaddr_in6 *)&g->src;
-			char buf[INET_ADDRSTR_LEN + 1] = {0};
-			int t_port;
-
-			inet_pton_port(AF_INET6, g->group, &grp->sin6_addr, &t_port, port);
-			grp->sin6_family = AF_INET6;
-			grp->sin6_port   = htons(t_port);
-
-			if (g->source) {
-				inet_pton_port(AF_INET6, g->source, &src->sin6_addr, &t_port, 0);
-				src->sin6_family = AF_INET6;
-				src->sin6_port   = htons(t_port);
-			}
-
-			DEBUG("IP6: <%s> grp: %s:%u", g->group, inet_ntop(AF_INET6, &grp->sin6_addr, buf, sizeof(buf)), ntohs(grp->sin6_port));
-			DEBUG("IP6: <%s> src: %s:%u", g->source?g->source:"", inet_ntop(AF_INET6, &src->sin6_addr, buf, sizeof(buf)), ntohs(src->sin6_port));
-			need6++;
-		} else
-#endif
-		{
-			struct sockaddr_in *grp = (struct sockaddr_in *)&g->grp;
-			struct sockaddr_in *src = (struct sockaddr_in *)&g->src;
-			char buf[INET_ADDRSTR_LEN + 1] = {0};
-			int t_port;
-
-			inet_pton_port(AF_INET, g->group, &grp->sin_addr, &t_port, port);
-			grp->sin_family = AF_INET;
-			grp->sin_port   = htons(t_port);
-
-			if (g->source) {
-				inet_pton_port(AF_INET, g->source, &src->sin_addr, &t_port, 0);
-				src->sin_family = AF_INET;
-				src->sin_port   = htons(t_port);
-			}
-
-			DEBUG("IP4: <%s> grp: %s:%u", g->group, inet_ntop(AF_INET, &grp->sin_addr, buf, sizeof(buf)), ntohs(grp->sin_port));
-			DEBUG("IP4: <%s> src: %s:%u", g->source?g->source:"", inet_ntop(AF_INET, &src->sin_addr, buf, sizeof(buf)), ntohs(src->sin_port));
-			need4++;
-		}
-#ifdef HAVE_STRUCT_SOCKADDR_STORAGE_SS_LEN
-		g->grp.ss_len = inet_addrlen(&g->grp);
-		if (g->source)
-			g->src.ss_len = inet_addrlen(&g->src);
-#endif
 
-		memset(g->status, ' ', STATUS_HISTORY - 1);
-		g->spin  = g->group[strlen(g->group) - 1];
-	}
+	/* readers of -r FILE may go away, get EPIPE instead */
+	signal(SIGPIPE, SIG_IGN);
 
 	pev_init();
 	pev_sig_add(SIGINT,   exit_loop, NULL);
 	pev_sig_add(SIGHUP,   exit_loop, NULL);
 	pev_sig_add(SIGTERM,  exit_loop, NULL);
-	pev_timer_add(0, period, scroll_cb, NULL);
+	if (!attach_path)
+		pev_timer_add(0, period, scroll_cb, NULL);
+	log_start();
 	if (pres > 1) {
 		int flags;
 
@@ -978,8 +1434,13 @@ int main(int argc, char *argv[])
 	}
 	if (deadline)
 		pev_timer_add(0, deadline * 1000000, deadline_cb, NULL);
+	if (report_init() || metrics_init() || shm_init(join) || ctrl_init())
+		return 1;
 
-	if (!join) {
+	if (attach_path) {
+		if (attach_start())
+			return 1;
+	} else if (!join) {
 		if ((rc = sender_init())) {
 			printf("Failed initializing sender, return code %d, aborting.\n", rc);
 			return 1;
@@ -989,6 +1450,9 @@ int main(int argc, char *argv[])
 			printf("Failed initializing receiver, return code %d, aborting.\n", rc);
 			return 1;
 		}
+		if (churn_init())
+			return 1;
+		sizes_init();
 	}
 
 	start = time(NULL);
@@ -1004,11 +1468,16 @@ int main(int argc, char *argv[])
 	if (!rc) {
 		DEBUG("Leaving main loop");
 		show_stats();
+		report_exit();
 	}
+	shm_exit();
+	ctrl_exit();
 
 	if (foreground) {
 		if (pres > 1) {
+			log_show(0);
 			gotoxy(0, EXIT_ROW);
+			scr_flush();
 			showcursor();
 			ttcooked();
 		} else
@@ -19,27 +19,35 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include "addr.h"
 #include "log.h"
 #include "pev.h"
 #include "queue.h"
 
-#define BUFSZ           1606	/* +42 => 1648 */
+#define PAYLOAD_MAX     65507	/* 65535 - IPv4/UDP header */
+#define PAYLOAD_MIN     18	/* SEQ_KEY and sequence number, sent */
+#define DEFAULT_BYTES   100
+#define HEADER_LEN      160	/* Room for the text header of payload() */
 #define DEFAULT_GROUP   "225.1.2.3"
 #define DEFAULT_PORT    1234
 #define MAGIC_KEY       "Sender PID "
 #define SEQ_KEY         "count: "
 #define FREQ_KEY        "freq: "
 
-#define STATUS_HISTORY  1024
-#define STATUS_POS      (STATUS_HISTORY - 2)
+#define STATUS_HISTORY  1024	/* Max history, hist_len is sized to screen */
+#define FRAME_PERIOD    50000	/* Max 20 frames/sec, in usec like period */
+#define DUP_WINDOW      1024	/* Sequence numbers tracked for dupes, bits */
 
 /* Positions on screen for ui */
 #define TITLE_ROW       1
 #define HOSTDATE_ROW    2
 #define HEADING_ROW     3
 #define GROUP_ROW       4
-#define LOGHEADING_ROW  (group_num + GROUP_ROW + 1)
+#define LOGHEADING_ROW  (group_rows + GROUP_ROW + 1)
+#define LOG_MIN         5	/* Min rows for log, incl. heading and spacing */
+#define TOP_MAX         64	/* Worst groups tracked, see top_update() */
 #define LOG_ROW         (LOGHEADING_ROW + 1)
 #define EXIT_ROW        (LOG_ROW + LOG_MAX)
 
@@ -48,39 +56,100 @@
 #define NELEMS(array) (sizeof(array) / sizeof(array[0]))
 #endif
 
-/* Group info */
-struct gr {
-	TAILQ_ENTRY(gr) entry;
-
-	int          sd;
+/* Per-packet counters of a group, one dense array for all, see group.c */
+struct grstat {
 	uint64_t     bytes;
-	uint64_t     obytes;
-	size_t       rate;
 	size_t       count;
-	size_t       seq;
+	size_t       seq;	/* next expected/to send */
+	size_t       top;	/* highest seen + 1, for dup detection */
 	size_t       gaps;
+	size_t       lost;	/* packets missing in gaps */
 	size_t       dupes;
 	size_t       order;
 	size_t       delayed;
 	size_t       invalid;
-	char        *source;
-	char        *group;
+	size_t       frags;	/* arrived fragmented */
+	size_t       trunc;	/* larger than receive buffer */
+	size_t       last;	/* period of last received packet */
+	size_t       hcol;	/* history column of last status update */
+} __attribute__((aligned(64)));
+
+struct agg;
+TAILQ_HEAD(agg_list, agg);
+
+/* Aggregate of a range of groups, large ranges are split in blocks */
+struct agg {
+	TAILQ_ENTRY(agg) entry;
+	struct agg_list sub;	/* blocks of a large range */
+	size_t       nsub;
+	struct agg  *parent;
+
+	char        *name;
+	struct gr   *first;
+	size_t       pos;	/* index of first group */
+	size_t       num;	/* number of groups */
+
+	uint64_t     bytes;
+	size_t       count;
+	size_t       lost;
+	uint64_t     obytes;
+	size_t       rate;
+	struct gr   *worst;	/* highest score, see top_update() */
+};
+
+struct sizes;
+
+/* Sender profile of a group, zero for the defaults of -b, -B and -f */
+struct profile {
+	uint32_t     size;	/* payload, bytes, max of sizes */
+	uint32_t     pps;	/* packets/s */
+	uint32_t     burst;	/* packets per send */
+	const struct sizes *sizes;	/* size distribution, shared */
+};
+
+/* Group info */
+struct gr {
+	TAILQ_ENTRY(gr) entry;
+
+	struct grstat *st;	/* hot, per-packet counters */
+	char        *status;	/* history ring, hist_len periods */
+	uint64_t    *seen;	/* receiver, DUP_WINDOW seqnos bitmap */
+
+	int          sd;
+	const char  *source;	/* shared by all groups with it */
+	char        *group;	/* gname, or longer name */
 	inet_addr_t  src;
 	inet_addr_t  grp;	/* to */
-	size_t       seqnos[STATUS_HISTORY]; /* for dup detection */
-	char         status[STATUS_HISTORY];
+	uint64_t     obytes;
+	size_t       rate;
+	uint64_t     rbytes;	/* bytes at last report, see report.c */
+	uint64_t     score;	/* recent problems, see top_update() */
+	size_t       top;	/* index + 1 in top list, 0 if not */
 	size_t       spin;
+	struct zcbuf *zc;	/* sender, MSG_ZEROCOPY buffers */
+	struct profile prof;	/* sender */
+	struct agg  *agg;	/* innermost aggregate */
+	uint64_t     cjoin;	/* churn, usec of join, until first packet */
+	uint64_t     cleave;	/* churn, usec of leave */
+	uint64_t     clast;	/* churn, usec of last packet */
+	char         gname[INET_ADDRSTR_LEN];
 };
 
 TAILQ_HEAD(gr_list, gr);
 extern struct gr_list groups;
+extern struct agg_list aggs;
 
 extern int help;
+extern int join;
 extern int pres;
 extern int width;
 extern int height;
 extern int duplicate;
 extern int foreground;
+extern int xdp;
+extern int offload;
+extern int zerocopy;
+extern int hdronly;
 
 extern int need4;
 extern int need6;
@@ -88,27 +157,212 @@ extern int need6;
 extern char iface[];
 
 extern int period;
+extern int port;
 extern size_t bytes;
+extern size_t burst;
 extern size_t count;
 extern unsigned char ttl;
 
 extern size_t group_num;
+extern size_t agg_num;
+extern int group_rows;
+extern size_t htick;
+extern size_t hist_len;
+extern size_t hist_per;
 
 extern void plotter_show(int signo);
+extern void present(int signo);
+extern void view_update(void);
+
+/*
+ * The status history of each group is a ring of columns, each column is
+ * hist_per periods, so that the plotters can be drawn at a capped frame
+ * rate also with very short periods.  Only the current column, derived
+ * from the period counter htick, changes when the history is aged.
+ * Columns a group has not been updated in are cleared lazily, on its next
+ * update.  Within a column the most severe status wins, in this order:
+ */
+#define STATUS_SEVERITY " ._<:-IE"	/* '-' is a gap, shown as ' ' */
+
+static inline size_t hist_now(void)
+{
+	return htick / hist_per;
+}
+
+static inline void hist_sync(struct gr *g)
+{
+	size_t now = hist_now();
+	size_t n = now - g->st->hcol;
+
+	if (!n)
+		return;
+	if (n > hist_len)
+		n = hist_len;
+
+	while (n--)
+		g->status[(now - n) & (hist_len - 1)] = ' ';
+	g->st->hcol = now;
+}
+
+/* Update current column of group, unless it already has a worse status */
+static inline void hist_set(struct gr *g, char status)
+{
+	size_t pos;
+
+	hist_sync(g);
+	pos = hist_now() & (hist_len - 1);
+	if (strchr(STATUS_SEVERITY, status) > strchr(STATUS_SEVERITY, g->status[pos]))
+		g->status[pos] = status;
+}
+
+/* Status of a given column, for readers */
+static inline char hist_status(const struct gr *g, size_t col)
+{
+	size_t last = g->st->hcol;
+
+	if (col > last || last - col >= hist_len)
+		return ' ';
+
+	return g->status[col & (hist_len - 1)];
+}
+
+/* Payload size of a group, as sender */
+static inline size_t gr_size(const struct gr *g)
+{
+	return g->prof.size ?: bytes;
+}
+
+/* Add num packets of len bytes in total to the aggregates of a group */
+static inline void agg_count(struct gr *g, size_t num, size_t len)
+{
+	struct agg *a;
+
+	for (a = g->agg; a; a = a->parent) {
+		a->count += num;
+		a->bytes += len;
+	}
+}
+
+/* Add num lost packets to a group and its aggregates */
+static inline void count_lost(struct gr *g, size_t num)
+{
+	struct agg *a;
+
+	g->st->lost += num;
+	for (a = g->agg; a; a = a->parent)
+		a->lost += num;
+}
 
 /* strlcpy.c */
 #ifndef HAVE_STRLCPY
 size_t strlcpy(char *dst, const char *src, size_t len);
 #endif
 
+/* group.c */
+extern char *group_file;
+
+extern struct gr *group_add   (const char *source, const char *group);
+extern long       group_parse (const char *arg);
+extern long       group_args  (int argc, char *argv[]);
+extern long       group_load  (void);
+extern void       group_del   (struct gr *g);
+extern long       group_leave (const char *arg, void (*cb)(struct gr *g));
+extern void       group_reset (void);
+extern int        group_init  (int rx);
+extern int        group_commit(void);
+extern int        group_range (struct gr *first, size_t num);
+extern void       top_update  (struct gr *g, size_t num);
+extern size_t     top_list    (struct gr **list, size_t max);
+extern uint64_t   top_recent  (const struct gr *g);
+
+/* attach.c */
+extern char *attach_path;
+
+extern int  attach_init  (void);
+extern int  attach_start (void);
+
+/* churn.c */
+extern int    churn;
+extern double churn_rate;
+extern int    churn_random;
+
+extern int  churn_init   (void);
+extern void churn_rx     (struct gr *g);
+extern void churn_del    (struct gr *g);
+extern void churn_update (void);
+extern void churn_show   (void);
+
+/* ctrl.c */
+extern char *ctrl_path;
+
+extern int  ctrl_init    (void);
+extern void ctrl_exit    (void);
+extern void ctrl_snapshot(void);
+
 /* daemonize.c */
 extern int daemonize     (void);
 
+/* metrics.c */
+extern char *metrics_addr;
+
+extern int  metrics_init (void);
+
+/* shm.c */
+extern char *shm_name;
+
+extern int  shm_init     (int rx);
+extern int  shm_update   (void);
+extern void shm_exit     (void);
+
+/* report.c */
+extern char *report_file;
+extern int   report_interval;
+
+extern int  report_init  (void);
+extern void report_exit  (void);
+
 /* receiver.c */
 extern int receiver_init (void);
+extern int receiver_nofile(size_t num);
+extern int receiver_add  (struct gr *g);
+extern void receiver_del (struct gr *g);
+extern int receiver_churn(struct gr *g, int on);
 extern int receiver      (int count);
+extern int recv_payload  (struct gr *g, char *buf, size_t len, size_t size);
+extern void receiver_check(void);
+
+/* sizes.c */
+extern const struct sizes *sizes_get(const char *arg);
+extern size_t sizes_max  (const struct sizes *d);
+extern size_t sizes_pick (const struct gr *g, size_t seq);
+extern void   sizes_init (void);
+extern void   sizes_rx   (size_t size);
+extern void   sizes_lost (const struct gr *g, size_t seq, size_t num);
+extern void   sizes_show (unsigned long secs);
 
 /* sender.c */
 extern int sender_init   (void);
+extern void sender_rate  (long pps);
+extern int sender_update (void);
+
+/* xdp.c */
+#ifdef HAVE_XDP
+extern int  xdp_init     (int rx);
+extern void xdp_exit     (void);
+extern int  xdp_update   (void);
+extern int  xdp_send     (struct gr *g, const char *buf, size_t len);
+extern void xdp_flush    (void);
+#else
+static inline int xdp_init(int rx)
+{
+	(void)rx;
+	ERROR("AF_XDP not supported on this system, falling back to sockets.");
+	return 1;
+}
+static inline void xdp_exit(void) { }
+static inline int  xdp_update(void) { return 0; }
+static inline int  xdp_send(struct gr *g, const char *buf, size_t len) { (void)g; (void)buf; (void)len; return -1; }
+static inline void xdp_flush(void) { }
+#endif
 
 #endif /* MCJOIN_H_ */
@@ -0,0 +1,444 @@
+/* Prometheus/OpenMetrics exporter, a minimal HTTP server in the event loop
+ *
+ * Copyright (c) 2008-2025  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The exposition of all groups is composed in one buffer, a snapshot
+ * that is reused by all scrapes within METRICS_AGE.  Responses are
+ * written with non-blocking sockets, when a client cannot take more the
+ * rest is sent from a short timer, so a large scrape never stalls the
+ * receiving of packets.  Only GET requests are served, one per
+ * connection.  Clients that have not sent the request line, or taken
+ * any of the response, within METRICS_IDLE are dropped, so they cannot
+ * hold on to a slot, or the snapshot.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "log.h"
+#include "mcjoin.h"
+#include "pev.h"
+
+#define METRICS_AGE     1	/* sec, max age of snapshot */
+#define METRICS_CLIENTS 4	/* concurrent scrapes */
+#define METRICS_RETRY   10000	/* usec, between writes to slow clients */
+#define METRICS_HDR     160	/* room for HTTP header before body */
+#define METRICS_LINE    192	/* max length of one sample */
+#define METRICS_IDLE    2	/* sec, to send the request, or take more */
+#define METRICS_REQ     1024	/* max length of request line */
+
+char *metrics_addr;		/* -M [ADDR:]PORT */
+
+struct client {
+	int     sd;
+	int     id;		/* pev id, while reading request */
+	size_t  off;		/* sent so far of response */
+	size_t  len;
+	char   *buf;		/* response, in snapshot */
+	char    req[METRICS_REQ];
+	size_t  rlen;
+	time_t  since;		/* accepted, or last took some */
+};
+
+static struct client clients[METRICS_CLIENTS];
+static int    mtid = -1;	/* retry timer */
+static int    itid = -1;	/* idle timer, armed while reading requests */
+static int    idling;
+
+static char  *snap;		/* METRICS_HDR bytes, then body */
+static size_t snap_size;
+static size_t snap_len;
+static time_t snap_time;
+
+static const struct {
+	const char *name;
+	const char *type;
+	const char *help;
+	size_t      offset;
+} families[] = {
+	{ "packets",   "counter", "Packets sent or received",    offsetof(struct grstat, count)   },
+	{ "bytes",     "counter", "Payload bytes",               offsetof(struct grstat, bytes)   },
+	{ "gaps",      "counter", "Gaps in sequence numbers",    offsetof(struct grstat, gaps)    },
+	{ "lost",      "counter", "Packets missing in gaps",     offsetof(struct grstat, lost)    },
+	{ "dupes",     "counter", "Duplicate packets",           offsetof(struct grstat, dupes)   },
+	{ "reordered", "counter", "Packets out of order",        offsetof(struct grstat, order)   },
+	{ "delayed",   "counter", "Packets after a silent period", offsetof(struct grstat, delayed) },
+	{ "invalid",   "counter", "Packets without sequence number", offsetof(struct grstat, invalid) },
+	{ "frags",     "counter", "Packets that arrived fragmented", offsetof(struct grstat, frags) },
+	{ "truncated", "counter", "Packets larger than receive buffer", offsetof(struct grstat, trunc) },
+};
+
+static int append(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+
+static int append(const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if (snap_len + METRICS_LINE > snap_size) {
+		size_t size = snap_size ? snap_size * 2 : 64 * 1024;
+		char *buf;
+
+		buf = realloc(snap, size);
+		if (!buf)
+			return -1;
+		snap      = buf;
+		snap_size = size;
+	}
+
+	va_start(ap, fmt);
+	len = vsnprintf(&snap[snap_len], snap_size - snap_len, fmt, ap);
+	va_end(ap);
+	if (len < 0 || (size_t)len >= snap_size - snap_len)
+		return -1;
+	snap_len += len;
+
+	return 0;
+}
+
+static uint64_t value(const struct grstat *st, size_t offset)
+{
+	if (offset == offsetof(struct grstat, bytes))
+		return st->bytes;
+
+	return *(const size_t *)((const char *)st + offset);
+}
+
+/* Compose body after METRICS_HDR, one family at a time */
+static int snapshot(void)
+{
+	struct gr *g;
+	size_t i;
+
+	snap_len = METRICS_HDR;
+	for (i = 0; i < NELEMS(families); i++) {
+		if (append("# TYPE mcjoin_%s %s\n# HELP mcjoin_%s %s\n", families[i].name,
+			   families[i].type, families[i].name, families[i].help))
+			return -1;
+
+		TAILQ_FOREACH(g, &groups, entry) {
+			if (append("mcjoin_%s_total{source=\"%s\",group=\"%s\"} %" PRIu64 "\n",
+				   families[i].name, g->source ?: "*", g->group,
+				   value(g->st, families[i].offset)))
+				return -1;
+		}
+	}
+
+	if (append("# TYPE mcjoin_rate_bps gauge\n# HELP mcjoin_rate_bps Bits per second, 5 sec average\n"))
+		return -1;
+	TAILQ_FOREACH(g, &groups, entry) {
+		if (append("mcjoin_rate_bps{source=\"%s\",group=\"%s\"} %zu\n",
+			   g->source ?: "*", g->group, g->rate * 8))
+			return -1;
+	}
+
+	if (append("# EOF\n"))
+		return -1;
+
+	snap_time = time(NULL);
+	return 0;
+}
+
+static int busy(void)
+{
+	int i;
+
+	for (i = 0; i < METRICS_CLIENTS; i++) {
+		if (clients[i].sd != -1 && clients[i].buf)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void drop(struct client *c)
+{
+	if (c->id != -1)
+		pev_sock_close(c->sd);
+	else
+		close(c->sd);
+	c->sd  = -1;
+	c->id  = -1;
+	c->buf = NULL;
+}
+
+/* Send as much as the client takes, returns 1 if there is more */
+static int send_more(struct client *c)
+{
+	while (c->off < c->len) {
+		ssize_t num;
+
+		num = send(c->sd, &c->buf[c->off], c->len - c->off, MSG_NOSIGNAL);
+		if (num < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 1;
+
+			DEBUG("Failed sending metrics: %s", strerror(errno));
+			break;
+		}
+		c->off  += num;
+		c->since = time(NULL);
+	}
+
+	drop(c);
+	return 0;
+}
+
+static void retry_cb(int id, void *arg)
+{
+	int i, more = 0;
+
+	(void)id;
+	(void)arg;
+
+	for (i = 0; i < METRICS_CLIENTS; i++) {
+		if (clients[i].sd != -1 && clients[i].buf)
+			more |= send_more(&clients[i]);
+	}
+
+	if (more)
+		pev_timer_set(mtid, METRICS_RETRY);
+}
+
+static void respond(struct client *c, const char *status, const char *type, const char *body,
+		    size_t len)
+{
+	char hdr[METRICS_HDR];
+	int hlen;
+
+	hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.0 %s\r\nContent-Type: %s\r\n"
+			"Content-Length: %zu\r\nConnection: close\r\n\r\n", status, type, len);
+	if (hlen < 0 || hlen >= (int)sizeof(hdr)) {
+		drop(c);
+		return;
+	}
+
+	if (!body) {
+		/* short error reply, fits in socket buffer */
+		if (send(c->sd, hdr, hlen, MSG_NOSIGNAL) < 0)
+			DEBUG("Failed sending metrics: %s", strerror(errno));
+		drop(c);
+		return;
+	}
+
+	/*
+	 * Header is put right before the body in the snapshot, all clients
+	 * sending the same snapshot have the same header.
+	 */
+	c->buf = &snap[METRICS_HDR - hlen];
+	memcpy(c->buf, hdr, hlen);
+	c->off = 0;
+	c->len = hlen + len;
+
+	/* done reading, the rest is sent from retry_cb() */
+	pev_sock_del(c->id);
+	c->id = -1;
+
+	if (send_more(c))
+		pev_timer_set(mtid, METRICS_RETRY);
+}
+
+/* Drop clients that have not sent a request, or taken more, in time */
+static void idle_cb(int id, void *arg)
+{
+	time_t now = time(NULL);
+	int i, more = 0;
+
+	(void)arg;
+
+	for (i = 0; i < METRICS_CLIENTS; i++) {
+		struct client *c = &clients[i];
+
+		if (c->sd == -1)
+			continue;
+
+		if (now - c->since >= METRICS_IDLE) {
+			DEBUG("Dropping idle metrics client");
+			drop(c);
+			continue;
+		}
+		more = 1;
+	}
+
+	idling = more;
+	if (more)
+		pev_timer_set(id, 1000000);
+}
+
+static void client_cb(int sd, void *arg)
+{
+	struct client *c = arg;
+	ssize_t len;
+
+	len = recv(sd, &c->req[c->rlen], sizeof(c->req) - 1 - c->rlen, 0);
+	if (len <= 0) {
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		drop(c);
+		return;
+	}
+	c->rlen += len;
+	c->req[c->rlen] = 0;
+
+	/* the request line may come in parts, the rest of it is ignored */
+	if (!strstr(c->req, "\r\n")) {
+		if (c->rlen == sizeof(c->req) - 1)
+			respond(c, "414 URI Too Long", "text/plain", NULL, 0);
+		return;
+	}
+
+	if (strncmp(c->req, "GET /metrics ", 13) && strncmp(c->req, "GET / ", 6)) {
+		respond(c, "404 Not Found", "text/plain", NULL, 0);
+		return;
+	}
+
+	/* the snapshot cannot change while it is being sent */
+	if (!snap || (time(NULL) - snap_time >= METRICS_AGE && !busy())) {
+		if (snapshot()) {
+			ERROR("Failed composing metrics: %s", strerror(errno));
+			respond(c, "500 Internal Server Error", "text/plain", NULL, 0);
+			return;
+		}
+	}
+
+	respond(c, "200 OK", "application/openmetrics-text; version=1.0.0; charset=utf-8",
+		&snap[METRICS_HDR], snap_len - METRICS_HDR);
+}
+
+static void accept_cb(int sd, void *arg)
+{
+	struct client *c = NULL;
+	int i, cd;
+
+	(void)arg;
+
+	cd = accept(sd, NULL, NULL);
+	if (cd < 0)
+		return;
+
+	for (i = 0; i < METRICS_CLIENTS; i++) {
+		if (clients[i].sd == -1) {
+			c = &clients[i];
+			break;
+		}
+	}
+
+	if (!c || fcntl(cd, F_SETFL, O_NONBLOCK)) {
+		close(cd);
+		return;
+	}
+
+	c->id = pev_sock_add(cd, client_cb, c);
+	if (c->id < 0) {
+		c->id = -1;
+		close(cd);
+		return;
+	}
+
+	c->sd    = cd;
+	c->buf   = NULL;
+	c->rlen  = 0;
+	c->since = time(NULL);
+
+	if (!idling) {
+		idling = 1;
+		pev_timer_set(itid, 1000000);
+	}
+}
+
+/* Listen on metrics_addr, [ADDR:]PORT, default address 127.0.0.1 */
+int metrics_init(void)
+{
+	struct sockaddr_in sin = { 0 };
+	const char *port;
+	char addr[INET_ADDRSTRLEN] = "127.0.0.1";
+	int i, sd, on = 1;
+
+	if (!metrics_addr)
+		return 0;
+
+	for (i = 0; i < METRICS_CLIENTS; i++) {
+		clients[i].sd = -1;
+		clients[i].id = -1;
+	}
+
+	port = strrchr(metrics_addr, ':');
+	if (port) {
+		size_t len = port - metrics_addr + 1;
+
+		if (len > sizeof(addr))
+			len = sizeof(addr);
+		strlcpy(addr, metrics_addr, len);
+		port++;
+	} else
+		port = metrics_addr;
+
+	sin.sin_family = AF_INET;
+	sin.sin_port   = htons(atoi(port));
+	if (!sin.sin_port || inet_pton(AF_INET, addr, &sin.sin_addr) != 1) {
+		ERROR("Invalid metrics address %s, should be [ADDR:]PORT", metrics_addr);
+		return 1;
+	}
+
+	sd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sd < 0)
+		goto fail;
+
+	(void)setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(sd, (struct sockaddr *)&sin, sizeof(sin)) || listen(sd, METRICS_CLIENTS))
+		goto fail;
+
+	if (pev_sock_add(sd, accept_cb, NULL) < 0)
+		goto fail;
+
+	mtid = pev_timer_add(METRICS_RETRY, 0, retry_cb, NULL);
+	if (mtid < 0)
+		goto fail;
+
+	itid = pev_timer_add(1000000, 0, idle_cb, NULL);
+	if (itid < 0)
+		goto fail;
+
+	return 0;
+fail:
+	ERROR("Failed setting up metrics on %s: %s", metrics_addr, strerror(errno));
+	if (sd >= 0)
+		close(sd);
+	return 1;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -2,6 +2,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
@@ -43,7 +44,10 @@ struct pev {
 struct pev *pl;
 
 static int events[2];
-static int max_fdnum = -1;
+static struct pollfd *pfd;	/* sockets to poll(), rebuilt every run */
+static struct pev   **pfe;	/* entry of each pollfd */
+static size_t pfd_num;
+static size_t pfd_size;
 static int id = 1;
 static int running;
 static int status;
@@ -116,29 +120,49 @@ int pev_sig_set_cb_del(int id, void (*cb)(void *))
 
 /******************************* SOCKETS ******************************/
 
-static int nfds(void)
-{
-	return max_fdnum + 1;
-}
-
-static void sock_run(fd_set *fds)
+static int sock_run(void)
 {
 	struct pev *entry;
-	int fdmax = 0;
+	size_t num = 0;
 
-	FD_ZERO(fds);
 	for (entry = pl; entry; entry = entry->next) {
-		if (entry->type != PEV_SOCK)
-			continue;
+		if (entry->type == PEV_SOCK && entry->active)
+			num++;
+	}
+
+	if (num > pfd_size) {
+		struct pollfd *fds;
+		struct pev **fde;
+		size_t size = pfd_size ? pfd_size : 64;
+
+		while (size < num)
+			size *= 2;
+
+		fds = realloc(pfd, size * sizeof(*fds));
+		if (!fds)
+			return -1;
+		pfd = fds;
+
+		fde = realloc(pfe, size * sizeof(*fde));
+		if (!fde)
+			return -1;
+		pfe = fde;
+
+		pfd_size = size;
+	}
 
-		if (entry->sd > fdmax)
-			fdmax = entry->sd;
+	pfd_num = 0;
+	for (entry = pl; entry; entry = entry->next) {
+		if (entry->type != PEV_SOCK || !entry->active)
+			continue;
 
-		FD_SET(entry->sd, fds);
+		pfd[pfd_num].fd      = entry->sd;
+		pfd[pfd_num].events  = POLLIN;
+		pfd[pfd_num].revents = 0;
+		pfe[pfd_num++]       = entry;
 	}
 
-	if (fdmax)
-		max_fdnum = fdmax;
+	return 0;
 }
 
 int pev_sock_add(int sd, void (*cb)(int, void *), void *arg)
@@ -288,8 +312,10 @@ static int timer_start(const struct timespec *now)
 	}
 
 	/* Sanity check resulting value, prevent disabling timer */
-	if (it.it_value.tv_sec < 0)
-		it.it_value.tv_sec = 0;
+	if (it.it_value.tv_sec < 0) {
+		it.it_value.tv_sec  = 0;
+		it.it_value.tv_usec = 0;
+	}
 	if (it.it_value.tv_sec == 0 && it.it_value.tv_usec < 1)
 		it.it_value.tv_usec = 1;
 
@@ -345,7 +371,12 @@ static void timer_run(int signo, void *arg)
 				entry->active = -1;
 				continue;
 			}
-		}
+
+			/* re-armed by the callback, with pev_timer_set() */
+			if (entry->timeout)
+				timeout = entry->timeout;
+		} else if (entry->expiry.tv_sec || entry->expiry.tv_nsec)
+			continue;	/* expired, left for the SIGALRM to run */
 
 		sec  = timeout / 1000000;
 		usec = timeout % 1000000;
@@ -564,13 +595,14 @@ int pev_exit(int rc)
 	return timer_exit();
 }
 
-static void pev_check(fd_set *fds)
+static int pev_check(void)
 {
 	struct pev *entry;
 	int trestart = 0;
 
-	sock_run(fds);
 	pev_cleanup();
+	if (sock_run())
+		return -1;
 
 	for (entry = pl; entry; entry = entry->next) {
 		if (entry->type == PEV_TIMER && entry->active > 1) {
@@ -581,30 +613,33 @@ static void pev_check(fd_set *fds)
 
 	if (trestart)
 		timer_run(0, NULL);
+
+	return 0;
 }
 
 int pev_run(void)
 {
-	struct pev *entry, *next;
-	fd_set fds;
-
 	while (running) {
+		size_t i;
 		int num;
 
-		pev_check(&fds);
+		if (pev_check())
+			return -1;
 
 		errno = 0;
-		num = select(nfds(), &fds, NULL, NULL, NULL);
+		num = poll(pfd, pfd_num, -1);
 		if (num <= 0)
 			continue;
 
-		for (entry = pl; entry; entry = next) {
-			next = entry->next;
+		for (i = 0; i < pfd_num && num > 0; i++) {
+			struct pev *entry = pfe[i];
 
-			if (entry->type != PEV_SOCK)
+			if (!pfd[i].revents)
 				continue;
+			num--;
 
-			if (!FD_ISSET(entry->sd, &fds))
+			/* removed by a callback before it */
+			if (!entry->active)
 				continue;
 
 			if (entry->cb)
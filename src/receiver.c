@@ -23,9 +23,20 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <netinet/udp.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
 
 #include "mcjoin.h"
 
+#define GRO_MAX_SIZE 65535	/* Max size of coalesced datagrams */
+
+/* Shared by all sockets, the event loop reads one datagram at a time */
+static char  *rxbuf;
+static size_t rxlen;
+static size_t rxmax;		/* Larger datagrams are counted as truncated */
+static int    mtu = 1500;
+
 
 static int alloc_socket(inet_addr_t group)
 {
@@ -85,6 +96,16 @@ static int alloc_socket(inet_addr_t group)
 #endif
 	}
 
+#ifdef UDP_GRO
+	if (offload) {
+		val = 1;
+		if (setsockopt(sd, SOL_UDP, UDP_GRO, &val, sizeof(val))) {
+			ERROR("Failed enabling UDP_GRO: %s, disabling.", strerror(errno));
+			offload = 0;
+		}
+	}
+#endif
+
 	if (bind(sd, (struct sockaddr *)&ina, inet_addrlen(&ina))) {
 		switch (errno) {
 		case EPERM:
@@ -103,13 +124,14 @@ static int alloc_socket(inet_addr_t group)
 	return sd;
 }
 
-static int join_group(struct gr *sg)
+/* Join or leave group on socket sd, logged at prio */
+static int group_req(struct gr *sg, int sd, int join, int prio)
 {
 	char src[INET_ADDRSTR_LEN] = "*";
 	char grp[INET_ADDRSTR_LEN] = "";
 	struct group_source_req gsr;
 	struct group_req gr;
-	int sd, op, proto;
+	int op, proto;
 	int ifindex;
 	size_t len;
 	void *arg;
@@ -121,12 +143,6 @@ static int join_group(struct gr *sg)
 	}
 	DEBUG("Added iface %s, ifindex %d", iface, ifindex);
 
-	sd = alloc_socket(sg->grp);
-	if (sd < 0) {
-		DEBUG("Failed allocating socket.");
-		return 1;
-	}
-
 #ifdef AF_INET6
 	if (sg->grp.ss_family == AF_INET6)
 		proto = IPPROTO_IPV6;
@@ -138,13 +154,13 @@ static int join_group(struct gr *sg)
 		gsr.gsr_interface  = ifindex;
 		gsr.gsr_source     = sg->src;
 		gsr.gsr_group      = sg->grp;
-		op                 = MCAST_JOIN_SOURCE_GROUP;
+		op                 = join ? MCAST_JOIN_SOURCE_GROUP : MCAST_LEAVE_SOURCE_GROUP;
 		arg                = &gsr;
 		len                = sizeof(gsr);
 	} else {
 		gr.gr_interface    = ifindex;
 		gr.gr_group        = sg->grp;
-		op                 = MCAST_JOIN_GROUP;
+		op                 = join ? MCAST_JOIN_GROUP : MCAST_LEAVE_GROUP;
 		arg                = &gr;
 		len                = sizeof(gr);
 	}
@@ -152,20 +168,47 @@ static int join_group(struct gr *sg)
 	if (sg->source)
 		inet_address(&sg->src, src, sizeof(src));
 	inet_address(&sg->grp, grp, sizeof(grp));
-	PRINT("Joining (%s,%s) on %s, ifindex: %d, sd: %d", src, grp, iface, ifindex, sd);
+	if (LOG_ON(prio))
+		logit(prio, "%s (%s,%s) on %s, ifindex: %d, sd: %d\n", join ? "Joining" : "Leaving",
+		      src, grp, iface, ifindex, sd);
 
 	if (setsockopt(sd, proto, op, arg, len)) {
 		ERROR("Failed %s group (%s,%s) on sd %d ... %d: %s",
-		      src, grp, "joining", sd, errno, strerror(errno));
-		goto error;
+		      join ? "joining" : "leaving", src, grp, sd, errno, strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+static int join_group(struct gr *sg)
+{
+	int sd;
+
+	sd = alloc_socket(sg->grp);
+	if (sd < 0) {
+		DEBUG("Failed allocating socket.");
+		return 1;
+	}
+
+	if (group_req(sg, sd, 1, LOG_NOTICE)) {
+		close(sd);
+		return 1;
 	}
 	sg->sd = sd;
 
 	return 0;
+}
 
-error:
-	close(sd);
-	return 1;
+/* Leave explicitly, a closed socket would only leave when it is freed */
+static void leave_group(struct gr *sg)
+{
+	if (sg->sd < 0)
+		return;
+
+	group_req(sg, sg->sd, 0, LOG_NOTICE);
+	pev_sock_close(sg->sd);
+	sg->sd = -1;
 }
 
 struct in_addr *find_dstaddr(struct msghdr *msgh)
@@ -202,18 +245,147 @@ struct in6_addr *find_dstaddr6(struct msghdr *msgh)
 	return NULL;
 }
 
-static int isdup(const struct gr *g, size_t seq)
+/* Segment size of a UDP GRO coalesced buffer, or 0 if not coalesced */
+static size_t find_gro(struct msghdr *msgh)
 {
+#ifdef UDP_GRO
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msgh); cmsg; cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+			int segsz;
+
+			memcpy(&segsz, CMSG_DATA(cmsg), sizeof(segsz));
+			return segsz > 0 ? (size_t)segsz : 0;
+		}
+	}
+#else
+	(void)msgh;
+#endif
+
+	return 0;
+}
+
+/*
+ * Mark seq as seen in the bitmap of the last DUP_WINDOW sequence numbers,
+ * ending at the highest seen so far.  Returns 1 if already seen.
+ */
+static int isdup(struct gr *g, size_t seq)
+{
+	struct grstat *st = g->st;
+	uint64_t *seen = g->seen;
+	uint64_t bit;
 	size_t i;
 
-	for (i = 0; i <= STATUS_POS; i++) {
-		if (g->seqnos[i] == 0)
-			continue;
+	if (seq >= st->top) {
+		/* slide window, forget what falls out of it */
+		if (seq - st->top >= DUP_WINDOW)
+			memset(seen, 0, DUP_WINDOW / 8);
+		else {
+			for (i = st->top; i <= seq; i++) {
+				size_t j = i & (DUP_WINDOW - 1);
 
-		if (g->seqnos[i] == seq)
-			return 1;
+				seen[j / 64] &= ~(1ULL << (j % 64));
+			}
+		}
+		st->top = seq + 1;
+	} else if (st->top - seq > DUP_WINDOW)
+		return 0;	/* too old to tell */
+
+	i   = seq & (DUP_WINDOW - 1);
+	bit = 1ULL << (i % 64);
+	if (seen[i / 64] & bit)
+		return 1;
+	seen[i / 64] |= bit;
+
+	return 0;
+}
+
+/*
+ * Sequence number and status accounting of one received payload, shared
+ * between the socket and AF_XDP receive paths.  The size is that of the
+ * datagram on the wire, len may be less if truncated.  Note: buf must
+ * have room for a terminating NUL at buf[len].
+ */
+int recv_payload(struct gr *g, char *buf, size_t len, size_t size)
+{
+	size_t hlen = g->grp.ss_family == AF_INET ? 28 : 48;
+	struct grstat *st = g->st;
+	const char *ptr;
+	size_t seq = 0;
+	int pid = 0;
+	int dup;
+
+	if (churn)
+		churn_rx(g);
+	if (size + hlen > (size_t)mtu)
+		st->frags++;
+	sizes_rx(size);
+
+	buf[len] = 0;
+	ptr = strstr(buf, MAGIC_KEY);
+	if (ptr)
+		pid = atoi(ptr + strlen(MAGIC_KEY));
+	ptr = strstr(buf, SEQ_KEY);
+	if (!ptr) {
+		st->invalid++;
+		hist_set(g, 'I');
+		top_update(g, 1);
+		st->last = htick;
+		st->count++;
+		agg_count(g, 1, 0);
+		return -1;
+	}
+	seq = atoi(ptr + strlen(SEQ_KEY));
+
+	TRACE(TRACE_PKT, "Count %5zu, our PID %d, sender PID %d, group %s, exp. seq: %zu, recv. seq: %zu, msg: %s",
+	      st->count, getpid(), pid, g->group, st->seq, seq, buf);
+
+	if (seq == 0 && st->seq > 0) {
+		/* sender restarted, clear history to prevent false dup counts */
+		memset(g->seen, 0, DUP_WINDOW / 8);
+		st->top = 0;
+	}
+	dup = isdup(g, seq);
+
+	if (st->seq > 0 && st->seq != seq) {
+		if (seq == 0) {
+			/* a restart, not a loss */
+			st->gaps++;
+			hist_set(g, '-');
+		} else {
+			if (dup) {
+				st->dupes++;
+				hist_set(g, ':');
+				top_update(g, 1);
+			} else if (seq < st->seq) {
+				st->order++;
+				hist_set(g, '<');
+				top_update(g, 1);
+			} else { /* seq > st->seq */
+				st->gaps++;
+				hist_set(g, '-');
+				top_update(g, seq - st->seq);
+				count_lost(g, seq - st->seq);
+				sizes_lost(g, st->seq, seq - st->seq);
+			}
+		}
+	} else {
+		/* nothing in previous period, with bursts only the first is late */
+		if (htick - st->last > 1 && st->seq > 1) {
+			hist_set(g, '_');
+			st->delayed++;
+			top_update(g, 1);
+		} else
+			hist_set(g, '.');
 	}
 
+	st->last = htick;
+	st->seq = seq + 1; /* Next expected sequence number */
+	st->bytes += size;
+	st->count++;
+	agg_count(g, 1, size);
+
 	return 0;
 }
 
@@ -223,21 +395,19 @@ static int isdup(const struct gr *g, size_t seq)
  */
 static ssize_t recv_mcast(int sd, struct gr *g)
 {
+	char *buf = rxbuf;
 	struct sockaddr_storage src;
 	char addr[INET6_ADDRSTRLEN];
 	struct in_addr *dstaddr;
 	struct iovec iov[1];
 	struct msghdr msgh;
 	char cmbuf[0x100];
-	char buf[BUFSZ];
 	const char *dst;
-	const char *ptr;
-	size_t seq = 0;
+	size_t off, segsz, len;
 	ssize_t bytes;
-	int pid = 0;
 
 	iov[0].iov_base = buf;
-	iov[0].iov_len  = sizeof(buf);
+	iov[0].iov_len  = rxlen;
 
 	memset(&msgh, 0, sizeof(msgh));
 	msgh.msg_name       = &src;
@@ -247,7 +417,8 @@ static ssize_t recv_mcast(int sd, struct gr *g)
 	msgh.msg_control    = cmbuf;
 	msgh.msg_controllen = sizeof(cmbuf);
 
-	bytes = recvmsg(sd, &msgh, MSG_DONTWAIT);
+	/* On Linux MSG_TRUNC returns the real length of the datagram */
+	bytes = recvmsg(sd, &msgh, MSG_DONTWAIT | MSG_TRUNC);
 	if (bytes < 0)
 		return -1;
 
@@ -266,102 +437,187 @@ static ssize_t recv_mcast(int sd, struct gr *g)
 	}
 #endif
 
-	buf[bytes] = 0;
-	ptr = strstr(buf, MAGIC_KEY);
-	if (ptr)
-		pid = atoi(ptr + strlen(MAGIC_KEY));
-	ptr = strstr(buf, SEQ_KEY);
-	if (!ptr) {
-		g->invalid++;
-		g->status[STATUS_POS] = 'I';
-		g->count++;
-		return -1;
-	}
-	seq = atoi(ptr + strlen(SEQ_KEY));
-
-	DEBUG("Count %5zu, our PID %d, sender PID %d, group %s, exp. seq: %zu, recv. seq: %zu, msg: %s",
-	      g->count, getpid(), pid, g->group, g->seq, seq, buf);
-
 	if (strcmp(dst, g->group)) {
 		ERROR("Packet for group %s received on wrong socket, expected group %s.",
 		      dst, g->group);
 		return -1;
 	}
 
-	if (g->seq > 0 && g->seq != seq) {
-		if (seq == 0) {
-			size_t i;
+	/* In header only mode most of the datagram is left in the kernel */
+	segsz = find_gro(&msgh);
+	len = (size_t)bytes;
+	if ((segsz ? segsz : len) > rxmax)
+		g->st->trunc++;
+	if (len > rxlen)
+		len = rxlen;
+
+	if (!segsz)
+		return recv_payload(g, buf, len, bytes);
+
+	/* Split coalesced buffer back into datagrams, last may be shorter */
+	TRACE(TRACE_SEG, "GRO buffer of %zd bytes, segment size %zu", bytes, segsz);
+	for (off = 0; off < len; off += segsz) {
+		size_t seglen = len - off;
+		char next;
+
+		if (seglen > segsz)
+			seglen = segsz;
+
+		/* recv_payload() NUL terminates, save first byte of next */
+		next = buf[off + seglen];
+		recv_payload(g, &buf[off], seglen, seglen);
+		buf[off + seglen] = next;
+	}
 
-			/* sender restarted, clear history to prevent false dup counts */
-			for (i = 0; i < STATUS_POS; i++)
-				g->seqnos[i] = 0;
+	return 0;
+}
 
-			g->gaps++;
-			g->status[STATUS_POS] = ' ';
-		} else {
-			if (isdup(g, seq)) {
-				g->dupes++;
-				g->status[STATUS_POS] = ':';
-			} else if (seq < g->seq) {
-				g->order++;
-				g->status[STATUS_POS] = '<';
-			} else { /* seq > g->seq */
-				g->gaps++;
-				g->status[STATUS_POS] = ' ';
-			}
-		}
-	} else {
-		if (g->status[STATUS_POS - 1] == ' ' && g->seq > 1) {
-			g->status[STATUS_POS] = '_';
-			g->delayed++;
-		} else
-			g->status[STATUS_POS] = '.';
-	}
+/* Exit when all groups have received COUNT packets */
+void receiver_check(void)
+{
+	size_t total = count * group_num;
+	struct gr *g;
 
-	g->seqnos[STATUS_POS] = seq;
-	g->seq = seq + 1; /* Next expected sequence number */
-	g->bytes += bytes;
-	g->count++;
+	TAILQ_FOREACH(g, &groups, entry)
+		total -= g->st->count;
 
-	return 0;
+	if (total == 0)
+		pev_exit(0);
 }
 
 static void receive_cb(int sd, void *arg)
 {
-	struct gr *g;
+	struct gr *g = arg;
 
-	(void)arg;
+	recv_mcast(sd, g);
 
-	TAILQ_FOREACH(g, &groups, entry) {
-		if (g->sd == sd) {
-			recv_mcast(sd, g);
-			break;
-		}
+	if (count > 0)
+		receiver_check();
+}
+
+/* Used to tell if a datagram must have arrived fragmented */
+static int ifmtu(const char *ifname)
+{
+#ifdef SIOCGIFMTU
+	struct ifreq ifr;
+	int sd, rc = -1;
+
+	sd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sd < 0)
+		return -1;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name));
+	if (!ioctl(sd, SIOCGIFMTU, &ifr))
+		rc = ifr.ifr_mtu;
+	close(sd);
+
+	return rc;
+#else
+	(void)ifname;
+	return -1;
+#endif
+}
+
+/*
+ * Raise the open files limit for num groups, one socket each, plus stdio
+ * and the sockets of the event loop, etc.  Up to the hard limit.
+ */
+int receiver_nofile(size_t num)
+{
+	struct rlimit rlim;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim)) {
+		ERROR("Failed reading RLIMIT_NOFILE");
+		return -1;
+	}
+
+	DEBUG("NOFILE: current %ld max %ld", (long)rlim.rlim_cur, (long)rlim.rlim_max);
+	if (rlim.rlim_cur >= num + 10)
+		return 0;
+
+	rlim.rlim_cur = num + 10;
+	if (setrlimit(RLIMIT_NOFILE, &rlim)) {
+		ERROR("Too many groups, %zu sockets exceed the open files limit %ld",
+		      num, (long)rlim.rlim_max);
+		return -1;
 	}
+	DEBUG("NOFILE: set new current %ld max %ld", (long)rlim.rlim_cur, (long)rlim.rlim_max);
 
-	if (count > 0) {
-		size_t total = count * group_num;
+	return 0;
+}
 
-		TAILQ_FOREACH(g, &groups, entry)
-			total -= g->count;
+/* Join group, also used for groups added at runtime */
+int receiver_add(struct gr *g)
+{
+	if (join_group(g))
+		return 1;
 
-		if (total == 0)
-			pev_exit(0);
+	if (pev_sock_add(g->sd, receive_cb, g) == -1) {
+		ERROR("Failed adding socket %d of group %s to event loop: %s",
+		      g->sd, g->group, strerror(errno));
+		close(g->sd);
+		g->sd = -1;
+		return 1;
 	}
+
+	return 0;
+}
+
+/* Leave group, before it is removed */
+void receiver_del(struct gr *g)
+{
+	if (churn)
+		churn_del(g);
+	leave_group(g);
+}
+
+/* Leave or re-join group, keeping its socket, for churn.c */
+int receiver_churn(struct gr *g, int on)
+{
+	if (g->sd < 0)
+		return 1;
+
+	return group_req(g, g->sd, on, LOG_DEBUG);
 }
 
 int receiver_init(void)
 {
 	struct gr *g;
+	int rc;
+
+	/* -b BYTES as receiver is largest expected, the rest is truncated */
+	rxmax = bytes ? bytes : PAYLOAD_MAX;
+	rxlen = rxmax;
+	if (hdronly) {
+		/* A coalesced buffer cannot be split without its payload */
+		if (offload) {
+			ERROR("UDP GRO not possible in header only mode, disabling.");
+			offload = 0;
+		}
+		if (rxlen > HEADER_LEN)
+			rxlen = HEADER_LEN;
+	} else if (offload && rxlen < GRO_MAX_SIZE)
+		rxlen = GRO_MAX_SIZE;
 
-	TAILQ_FOREACH(g, &groups, entry) {
-		if (join_group(g))
-			return 1;
+	if (posix_memalign((void **)&rxbuf, 64, rxlen + 1)) {
+		ERROR("Failed allocating %zu bytes receive buffer: %s", rxlen, strerror(errno));
+		return 1;
+	}
+
+	rc = ifmtu(iface);
+	if (rc > 0)
+		mtu = rc;
 
-		if (pev_sock_add(g->sd, receive_cb, NULL) == -1)
+	TAILQ_FOREACH(g, &groups, entry) {
+		if (receiver_add(g))
 			return 1;
 	}
 
+	/* Joins above still needed, to get the IGMP/MLD reports out */
+	if (xdp && xdp_init(1))
+		xdp = 0;
+
 	return 0;
 }
 
@@ -0,0 +1,236 @@
+/* Machine readable statistics, NDJSON or CSV, at a fixed interval
+ *
+ * Copyright (c) 2008-2025  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Every interval one record per group, and one with the totals, is
+ * composed in a buffer and written with a single non-blocking write().
+ * If the reader of a pipe or FIFO cannot keep up, the rest is written
+ * on the next interval, and that interval is skipped.  The event loop
+ * is never blocked.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "mcjoin.h"
+#include "pev.h"
+
+#define REPORT_LINE  256	/* max length of one record */
+
+char *report_file;		/* -r FILE */
+int   report_interval = 1;	/* -R SEC */
+
+static int    rfd = -1;
+static int    csv;
+static char  *rbuf;
+static size_t rsize;
+static size_t roff;		/* start of pending output */
+static size_t rlen;		/* end of pending output */
+static size_t rskip;
+static struct timespec rlast;	/* time of last report */
+
+static int record(time_t now, const char *source, const char *group, const struct grstat *st,
+		  size_t bps)
+{
+	const char *fmt;
+	int len;
+
+	if (rsize - rlen < REPORT_LINE) {
+		size_t size = rsize ? rsize * 2 : 64 * REPORT_LINE;
+		char *buf;
+
+		buf = realloc(rbuf, size);
+		if (!buf)
+			return -1;
+		rbuf  = buf;
+		rsize = size;
+	}
+
+	if (csv)
+		fmt = "%lld,%s,%s,%zu,%" PRIu64 ",%zu,%zu,%zu,%zu,%zu,%zu,%zu\n";
+	else
+		fmt = "{\"time\":%lld,\"source\":\"%s\",\"group\":\"%s\",\"packets\":%zu,"
+			"\"bytes\":%" PRIu64 ",\"bps\":%zu,\"gaps\":%zu,\"lost\":%zu,"
+			"\"dupes\":%zu,\"order\":%zu,\"delayed\":%zu,\"invalid\":%zu}\n";
+
+	len = snprintf(&rbuf[rlen], rsize - rlen, fmt, (long long)now, source, group,
+		       st->count, st->bytes, bps, st->gaps, st->lost, st->dupes, st->order,
+		       st->delayed, st->invalid);
+	if (len < 0 || (size_t)len >= rsize - rlen)
+		return -1;
+	rlen += len;
+
+	return 0;
+}
+
+/* Write pending output, returns -1 if the reader is still behind */
+static int report_flush(void)
+{
+	while (roff < rlen) {
+		ssize_t num;
+
+		num = write(rfd, &rbuf[roff], rlen - roff);
+		if (num < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return -1;
+
+			/* e.g., EPIPE when the reader of a FIFO is gone */
+			ERROR("Failed writing stats to %s, stopping: %s", report_file, strerror(errno));
+			close(rfd);
+			rfd = -1;
+			break;
+		}
+		roff += num;
+	}
+
+	roff = rlen = 0;
+	return 0;
+}
+
+static void report(void)
+{
+	struct grstat total = { 0 };
+	time_t now = time(NULL);
+	struct timespec ts;
+	uint64_t usec;
+	size_t tbps = 0;
+	struct gr *g;
+
+	if (rfd < 0)
+		return;
+
+	if (report_flush()) {
+		if (!rskip++)
+			ERROR("Stats reader of %s too slow, skipping records", report_file);
+		return;
+	}
+	rskip = 0;
+
+	/* rate over actual time, the last record at exit is early */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	usec  = (ts.tv_sec - rlast.tv_sec) * 1000000 + (ts.tv_nsec - rlast.tv_nsec) / 1000;
+	rlast = ts;
+	if (!usec)
+		usec = 1;
+
+	TAILQ_FOREACH(g, &groups, entry) {
+		struct grstat *st = g->st;
+		size_t bps;
+
+		bps = (st->bytes - g->rbytes) * 8 * 1000000 / usec;
+		g->rbytes = st->bytes;
+
+		if (record(now, g->source ?: "*", g->group, st, bps))
+			goto fail;
+
+		total.count   += st->count;
+		total.bytes   += st->bytes;
+		total.gaps    += st->gaps;
+		total.lost    += st->lost;
+		total.dupes   += st->dupes;
+		total.order   += st->order;
+		total.delayed += st->delayed;
+		total.invalid += st->invalid;
+		tbps          += bps;
+	}
+
+	if (record(now, "", "total", &total, tbps))
+		goto fail;
+
+	report_flush();
+	return;
+fail:
+	ERROR("Failed composing stats record: %s", strerror(errno));
+	rlen = 0;
+}
+
+static void report_cb(int id, void *arg)
+{
+	(void)id;
+	(void)arg;
+
+	report();
+}
+
+/* Open report_file, CSV if it ends with .csv, otherwise NDJSON */
+int report_init(void)
+{
+	const char *ext;
+
+	if (!report_file)
+		return 0;
+
+	ext = strrchr(report_file, '.');
+	if (ext && !strcmp(ext, ".csv"))
+		csv = 1;
+
+	/* a FIFO blocks here until it has a reader, writes never block */
+	rfd = open(report_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (rfd < 0 || fcntl(rfd, F_SETFL, fcntl(rfd, F_GETFL) | O_NONBLOCK)) {
+		ERROR("Failed opening stats file %s: %s", report_file, strerror(errno));
+		if (rfd >= 0) {
+			close(rfd);
+			rfd = -1;
+		}
+		return 1;
+	}
+
+	if (csv) {
+		const char *hdr = "time,source,group,packets,bytes,bps,gaps,lost,dupes,order,delayed,invalid\n";
+
+		if (write(rfd, hdr, strlen(hdr)) < 0)
+			ERROR("Failed writing stats to %s: %s", report_file, strerror(errno));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &rlast);
+	if (pev_timer_add(0, report_interval * 1000000, report_cb, NULL) < 0) {
+		ERROR("Failed starting stats timer: %s", strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Last record at exit */
+void report_exit(void)
+{
+	if (rfd < 0)
+		return;
+
+	report();
+	close(rfd);
+	rfd = -1;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -16,11 +16,39 @@
 
 #include "screen.h"
 
+#include <ctype.h>
+#include <errno.h>
 #include <poll.h>
+#include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
 
+#define ATTR_BOLD      0x01
+#define ATTR_DIM       0x02
+#define ATTR_UNDERLINE 0x04
+#define ATTR_REVERSE   0x08
+
+/*
+ * Screen model.  A frame is composed in the cur cell buffer, using the
+ * same escape sequences as a terminal, and scr_flush() sends only the
+ * cells that differ from the previous frame, in old, with one write().
+ */
+struct cell {
+	char          ch;
+	unsigned char attr;
+};
+
+static struct cell *cur, *old;
+static int          cols, rows;
+static int          cx, cy;		/* cursor, 0-based, may be off screen */
+static unsigned char cattr;		/* attribute of next cell written */
+static int          invalid;	/* terminal state unknown, clear first */
+
+static char        *obuf;		/* output of one flush */
+static size_t       olen, osize;
+
 #ifdef HAVE_TERMIOS_H
 static struct	termios	oldtty;			/* POSIX tty settings. */
 static struct	termios	newtty;
@@ -103,6 +131,341 @@ int ttsize(int *cols, int *rows)
 }
 #endif /* HAVE_TERMIOS_H */
 
+/* (Re)size screen model, the next flush clears and redraws everything */
+int scr_init(int width, int height)
+{
+	size_t num = (size_t)width * height;
+
+	if (width < 1 || height < 1)
+		return -1;
+
+	if (width != cols || height != rows) {
+		struct cell *a, *b;
+
+		a = realloc(cur, num * sizeof(*cur));
+		if (!a)
+			return -1;
+		cur = a;
+
+		b = realloc(old, num * sizeof(*old));
+		if (!b)
+			return -1;
+		old = b;
+
+		cols = width;
+		rows = height;
+		scr_cls();
+	}
+	invalid = 1;
+
+	return 0;
+}
+
+static void fill(int from, int to)
+{
+	struct cell blank = { ' ', 0 };
+	int i;
+
+	if (!cur)
+		return;
+
+	if (from < 0)
+		from = 0;
+	if (to > cols * rows)
+		to = cols * rows;
+
+	for (i = from; i < to; i++)
+		cur[i] = blank;
+}
+
+/* Esc[2J - Clear screen */
+void scr_cls(void)
+{
+	fill(0, cols * rows);
+}
+
+/* Esc[0J - Clear screen from cursor down */
+void scr_clsdn(void)
+{
+	if (cy < rows)
+		fill(cy * cols + cx, cols * rows);
+}
+
+/* Esc[K - Clear to end of line */
+static void scr_clreol(void)
+{
+	if (cy < rows)
+		fill(cy * cols + cx, (cy + 1) * cols);
+}
+
+/* Esc[Line;ColumnH - Move cursor, 1-based like the terminal, 0 is 1 */
+void scr_goto(int x, int y)
+{
+	cx = x > 0 ? x - 1 : 0;
+	cy = y > 0 ? y - 1 : 0;
+}
+
+static void sgr(const int *arg, int num)
+{
+	int i;
+
+	if (!num)
+		cattr = 0;
+
+	for (i = 0; i < num; i++) {
+		switch (arg[i]) {
+		case 0:
+			cattr = 0;
+			break;
+		case 1:
+			cattr |= ATTR_BOLD;
+			break;
+		case 2:
+			cattr |= ATTR_DIM;
+			break;
+		case 4:
+			cattr |= ATTR_UNDERLINE;
+			break;
+		case 7:
+			cattr |= ATTR_REVERSE;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/*
+ * Parse a CSI sequence, Esc[, starting at s, returns the number of
+ * characters consumed.  Only what the UI uses is handled.
+ */
+static size_t csi(const char *s, size_t len)
+{
+	int arg[8] = { 0 };
+	int num = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		char ch = s[i];
+
+		if (isdigit((int)ch)) {
+			if (!num)
+				num = 1;
+			arg[num - 1] = arg[num - 1] * 10 + ch - '0';
+			continue;
+		}
+		if (ch == ';') {
+			if (!num)
+				num = 1;
+			if (num < (int)(sizeof(arg) / sizeof(arg[0])))
+				num++;
+			continue;
+		}
+
+		switch (ch) {
+		case 'm':
+			sgr(arg, num);
+			break;
+		case 'K':
+			scr_clreol();
+			break;
+		case 'J':
+			if (arg[0] == 2)
+				scr_cls();
+			else
+				scr_clsdn();
+			break;
+		case 'H':
+			scr_goto(arg[1], arg[0]);
+			break;
+		default:
+			break;
+		}
+
+		return i + 1;
+	}
+
+	return len;
+}
+
+void scr_write(const char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		char ch = s[i];
+
+		switch (ch) {
+		case '\e':
+			if (i + 1 < len && s[i + 1] == '[')
+				i += 1 + csi(&s[i + 2], len - i - 2);
+			break;
+
+		case '\r':
+			cx = 0;
+			break;
+
+		case '\n':
+			cy++;
+			break;
+
+		default:
+			if (cur && cy < rows && cx < cols)
+				cur[cy * cols + cx] = (struct cell){ ch, cattr };
+			cx++;
+			break;
+		}
+	}
+}
+
+void scr_puts(const char *s)
+{
+	scr_write(s, strlen(s));
+}
+
+int scr_printf(const char *fmt, ...)
+{
+	char buf[1024];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return len;
+	if ((size_t)len >= sizeof(buf))
+		len = sizeof(buf) - 1;
+
+	scr_write(buf, len);
+
+	return len;
+}
+
+static void emit(const char *s, size_t len)
+{
+	if (olen + len > osize) {
+		size_t sz = osize ? osize : 4096;
+		char *ptr;
+
+		while (sz < olen + len)
+			sz *= 2;
+
+		ptr = realloc(obuf, sz);
+		if (!ptr)
+			return;
+		obuf  = ptr;
+		osize = sz;
+	}
+
+	memcpy(&obuf[olen], s, len);
+	olen += len;
+}
+
+static void emit_goto(int x, int y)
+{
+	char buf[24];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "\e[%d;%dH", y + 1, x + 1);
+	emit(buf, len);
+}
+
+static void emit_attr(unsigned char attr)
+{
+	char buf[16] = "\e[0";
+	size_t len = 3;
+
+	if (attr & ATTR_BOLD) {
+		memcpy(&buf[len], ";1", 2);
+		len += 2;
+	}
+	if (attr & ATTR_DIM) {
+		memcpy(&buf[len], ";2", 2);
+		len += 2;
+	}
+	if (attr & ATTR_UNDERLINE) {
+		memcpy(&buf[len], ";4", 2);
+		len += 2;
+	}
+	if (attr & ATTR_REVERSE) {
+		memcpy(&buf[len], ";7", 2);
+		len += 2;
+	}
+	buf[len++] = 'm';
+
+	emit(buf, len);
+}
+
+/*
+ * Send the difference between the composed frame and the previous one
+ * to the terminal, in a single write().  The terminal cursor is left at
+ * the position of the cursor in the model.
+ */
+void scr_flush(void)
+{
+	static int x = -1, y = -1;	/* terminal cursor, -1 unknown */
+	unsigned char attr = 0;
+	size_t off = 0;
+	int i, j;
+
+	if (!cur)
+		return;
+
+	olen = 0;
+	if (invalid) {
+		emit("\e[0m\e[2J", 8);
+		for (i = 0; i < cols * rows; i++)
+			old[i] = (struct cell){ ' ', 0 };
+		x = y = -1;
+		invalid = 0;
+	}
+
+	for (i = 0; i < rows; i++) {
+		for (j = 0; j < cols; j++) {
+			struct cell *c = &cur[i * cols + j];
+			struct cell *o = &old[i * cols + j];
+
+			if (c->ch == o->ch && c->attr == o->attr)
+				continue;
+
+			if (x != j || y != i)
+				emit_goto(j, i);
+			if (c->attr != attr) {
+				emit_attr(c->attr);
+				attr = c->attr;
+			}
+			emit(&c->ch, 1);
+			*o = *c;
+
+			/* pending wrap at last column, position explicitly */
+			x = j + 1 < cols ? j + 1 : -1;
+			y = i;
+		}
+	}
+
+	if (attr)
+		emit("\e[0m", 4);
+	if (x != cx || y != cy) {
+		emit_goto(cx, cy);
+		x = cx;
+		y = cy;
+	}
+
+	while (off < olen) {
+		ssize_t n;
+
+		n = write(STDERR_FILENO, &obuf[off], olen - off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		off += n;
+	}
+}
+
 void progress(void)
 {
 	const char *style = ".oOOo.";
@@ -18,18 +18,17 @@
 #define MCJOIN_SCREEN_H_
 
 #include "config.h"
+#include <stddef.h>
 #include "log.h"
 
 #ifdef HAVE_TERMIOS_H
 #include <termios.h>
 #endif
 
-/* Esc[2J                     - Clear screen */
-#define cls()                 fputs("\e[2J", stderr)
-/* Esc[0J                     - Clear screen from cursor down */
-#define clsdn()               fputs("\e[0J", stderr)
-/* Esc[Line;ColumnH           - Moves the cursor to the specified position (coordinates) */
-#define gotoxy(x,y)           fprintf(stderr, "\e[%d;%dH", (int)(y), (int)(x))
+/* Screen model, drawn to the terminal with scr_flush() */
+#define cls()                 scr_cls()
+#define clsdn()               scr_clsdn()
+#define gotoxy(x,y)           scr_goto((int)(x), (int)(y))
 /* Esc[?25l (lower case L)    - Hide Cursor */
 #define hidecursor()          fputs("\e[?25l", stderr)
 /* Esc[?25h (lower case H)    - Show Cursor */
@@ -58,6 +57,15 @@ int ttsize   (int *, int *);
 
 #endif /* HAVE_TERMIOS_H */
 
+int  scr_init   (int width, int height);
+void scr_cls    (void);
+void scr_clsdn  (void);
+void scr_goto   (int x, int y);
+void scr_write  (const char *s, size_t len);
+void scr_puts   (const char *s);
+int  scr_printf (const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+void scr_flush  (void);
+
 void progress(void);
 
 #endif /* MCJOIN_SCREEN_H_ */
@@ -23,8 +23,269 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
+#include <netinet/udp.h>
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
+
+#define GSO_MAX_SEGS   64	/* UDP_MAX_SEGMENTS in older kernels */
+#define GSO_MAX_SIZE   65000	/* Below max IP datagram size, incl. headers */
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define HAVE_ZEROCOPY 1
+#endif
+
+#define ZC_SLOTS       8	/* Zerocopy buffers per group */
+
+#define SCHED_TICK     1000	/* usec, shortest interval of a class */
+#define SCHED_MAX      60000000	/* usec, longest interval of a class */
+#define SCHED_LATE     100000	/* usec, max catch-up after a stall */
+
+/* Zerocopy payload buffer, busy until kernel reports completion */
+struct zcbuf {
+	char  *buf;
+	size_t len;
+	int    busy;
+};
+
+/* Per socket zerocopy state, completion ids map to buffers in flight */
+struct zcsock {
+	int            sd;
+	uint32_t       next;
+	uint32_t       mask;
+	struct zcbuf **inflight;
+	int            copied;
+};
 
+static struct zcsock zc4 = { .sd = -1 };
+static struct zcsock zc6 = { .sd = -1 };
+
+/* Payload buffer, or GSO super-buffer, when not using zerocopy */
+static char  *sndbuf;
+static size_t sndlen;
+
+/*
+ * Groups with the same rate and burst are sent to by one class, each
+ * class has its own interval.  Classes with groups are kept in a heap
+ * on the time of their next send, and one one-shot timer is armed for
+ * the first, so each tick costs only the classes that are due.
+ */
+struct sclass {
+	struct gr  **grp;
+	size_t       num;
+	size_t       max;	/* allocated */
+	uint32_t     pps;	/* 0 for burst every -f period */
+	uint32_t     burst;
+	uint64_t     interval;	/* usec */
+	uint64_t     due;	/* usec, next send */
+	uint64_t     credit;
+	size_t       sent;	/* per group, for -c */
+};
+
+static struct sclass **classes;
+static size_t          nclass;
+static struct sclass **heap;	/* classes with groups, min-heap on due */
+static size_t          hlen;
+static int             stid = -1;
+static int             sd4 = -1;
+static int             sd6 = -1;
+
+/* Packets/s per group, set at runtime, overrides all profiles when >= 0 */
+static long pps = -1;
+
+#ifdef HAVE_ZEROCOPY
+static void zc_reap(struct zcsock *zs)
+{
+	char cmbuf[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+	struct cmsghdr *cmsg;
+	struct msghdr msgh;
+
+	while (1) {
+		memset(&msgh, 0, sizeof(msgh));
+		msgh.msg_control    = cmbuf;
+		msgh.msg_controllen = sizeof(cmbuf);
+
+		if (recvmsg(zs->sd, &msgh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+
+		for (cmsg = CMSG_FIRSTHDR(&msgh); cmsg; cmsg = CMSG_NXTHDR(&msgh, cmsg)) {
+			struct sock_extended_err serr;
+			uint32_t id;
+
+			if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+			    !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+				continue;
+
+			memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+			if (serr.ee_errno != 0 || serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			if ((serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && !zs->copied++)
+				PRINT("Kernel copies zerocopy buffers on sd %d, no gain on this path.", zs->sd);
+
+			/* Range of completed ids, inclusive */
+			for (id = serr.ee_info; id != serr.ee_data + 1; id++) {
+				struct zcbuf *zb = zs->inflight[id & zs->mask];
+
+				if (!zb)
+					continue;
+
+				zb->busy = 0;
+				zs->inflight[id & zs->mask] = NULL;
+			}
+		}
+	}
+}
+
+static void zc_cb(int sd, void *arg)
+{
+	(void)sd;
+	zc_reap(arg);
+}
+
+/* Ring of ids in flight, for the buffers of num groups, only ever grows */
+static int zc_size(struct zcsock *zs, size_t num)
+{
+	struct zcbuf **ring;
+	uint32_t size = 1, id;
+
+	while (size < num * ZC_SLOTS)
+		size <<= 1;
+	if (zs->inflight && size <= zs->mask + 1)
+		return 0;
+
+	ring = calloc(size, sizeof(*ring));
+	if (!ring)
+		return -1;
+
+	/* ids in flight are among the last mask + 1 sent */
+	if (zs->inflight) {
+		for (id = zs->next - zs->mask - 1; id != zs->next; id++)
+			ring[id & (size - 1)] = zs->inflight[id & zs->mask];
+		free(zs->inflight);
+	}
+	zs->inflight = ring;
+	zs->mask     = size - 1;
+
+	return 0;
+}
+
+/* Groups added at runtime, more buffers can be in flight */
+static void zc_update(void)
+{
+	if ((zc4.sd >= 0 && zc_size(&zc4, group_num)) ||
+	    (zc6.sd >= 0 && zc_size(&zc6, group_num)))
+		ERROR("Failed growing zerocopy state: %s", strerror(errno));
+}
+
+static void zc_init(int sd, int family)
+{
+	struct zcsock *zs = family == AF_INET ? &zc4 : &zc6;
+	int val = 1;
+
+	if (setsockopt(sd, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val))) {
+		ERROR("Failed enabling SO_ZEROCOPY: %s, using regular send.", strerror(errno));
+		return;
+	}
+
+	if (zc_size(zs, group_num)) {
+		ERROR("Failed allocating zerocopy state: %s", strerror(errno));
+		return;
+	}
+	zs->sd = sd;
+
+	/* Completions are signaled on the socket error queue */
+	if (pev_sock_add(sd, zc_cb, zs) < 0)
+		ERROR("Failed adding sd %d to event loop: %s", sd, strerror(errno));
+}
+
+/*
+ * Find a free zerocopy buffer for the group, buffers are allocated on
+ * first use.  Returns NULL if all are still in flight, in which case the
+ * caller falls back to a regular, copying, send.
+ */
+static struct zcbuf *zc_get(struct gr *g)
+{
+	struct zcsock *zs = g->grp.ss_family == AF_INET ? &zc4 : &zc6;
+	size_t len = sndlen;
+	int retry = 1;
+	size_t i;
+
+	if (zs->sd < 0)
+		return NULL;
+
+	if (!g->zc) {
+		g->zc = calloc(ZC_SLOTS, sizeof(struct zcbuf));
+		if (!g->zc)
+			return NULL;
+	}
+
+	do {
+		for (i = 0; i < ZC_SLOTS; i++) {
+			struct zcbuf *zb = &g->zc[i];
+
+			if (zb->busy)
+				continue;
+
+			/* send buffer grown at runtime, by a group with larger payload */
+			if (zb->buf && zb->len < len) {
+				free(zb->buf);
+				zb->buf = NULL;
+			}
+			if (!zb->buf) {
+				if (posix_memalign((void **)&zb->buf, sysconf(_SC_PAGESIZE), len)) {
+					zb->buf = NULL;
+					return NULL;
+				}
+				zb->len = len;
+			}
+
+			return zb;
+		}
+
+		zc_reap(zs);
+	} while (retry--);
+
+	TRACE(TRACE_SEG, "All zerocopy buffers for %s in flight, copying.", g->group);
+	return NULL;
+}
+
+static ssize_t zc_sendmsg(int sd, struct msghdr *msgh, struct zcbuf *zb)
+{
+	struct zcsock *zs = sd == zc4.sd ? &zc4 : &zc6;
+	ssize_t rc;
+
+	/* all ids of the ring in flight, must not overwrite any */
+	if (zs->inflight[zs->next & zs->mask])
+		return sendmsg(sd, msgh, 0);
+
+	rc = sendmsg(sd, msgh, MSG_ZEROCOPY);
+	if (rc < 0) {
+		/* Out of optmem, send this one the regular way */
+		if (errno == ENOBUFS)
+			return sendmsg(sd, msgh, 0);
+		return rc;
+	}
+
+	zb->busy = 1;
+	zs->inflight[zs->next++ & zs->mask] = zb;
+
+	return rc;
+}
+#else
+static void zc_init(int sd, int family)
+{
+	(void)sd;
+	(void)family;
+	ERROR("MSG_ZEROCOPY not supported on this system, using regular send.");
+	zerocopy = 0;
+}
+#define zc_get(g) NULL
+#define zc_sendmsg(sd, msgh, zb) sendmsg(sd, msgh, 0)
+static inline void zc_update(void) { }
+#endif
 
 static int send_socket(int family)
 {
@@ -96,84 +357,498 @@ static int send_socket(int family)
 		return -1;
 	}
 
+	if (zerocopy)
+		zc_init(sd, family);
+
 	return sd;
 }
 
-static void send_mcast(int sd, struct gr *g)
+/*
+ * Next payload for group, advance sequence number unless duplicating.
+ * Payloads too small for the whole header, e.g., the smallest of IMIX,
+ * carry only the sequence number.
+ */
+static void payload(struct gr *g, char *buf, size_t len)
 {
-	char buf[BUFSZ] = { 0 };
-	struct sockaddr *dest;
-	socklen_t len;
 	size_t seq;
+	int rc;
 
-	dest = (struct sockaddr *)&g->grp;
-	len  = inet_addrlen(&g->grp);
-
-	seq = g->seq;
+	seq = g->st->seq;
 	if (!duplicate)
-		g->seq++;
-
-	snprintf(buf, sizeof(buf), "%s%u, MC group %s ... %s%zu, %s%d",
-		 MAGIC_KEY, getpid(), g->group,
-		 SEQ_KEY, seq,
-		 FREQ_KEY, period / 1000);
-	DEBUG("Sending packet, msg: %s", buf);
-	if (sendto(sd, buf, bytes, 0, dest, len) < 0) {
+		g->st->seq++;
+
+	memset(buf, 0, len);
+	rc = snprintf(buf, len, "%s%u, MC group %s ... %s%zu, %s%d",
+		      MAGIC_KEY, getpid(), g->group,
+		      SEQ_KEY, seq,
+		      FREQ_KEY, period / 1000);
+	if (rc >= (int)len) {
+		memset(buf, 0, len);
+		snprintf(buf, len, "%s%zu", SEQ_KEY, seq);
+	}
+	TRACE(TRACE_PKT, "Sending packet, msg: %s", buf);
+}
+
+/* Account num packets of len bytes in total */
+static void account(struct gr *g, size_t num, size_t len, ssize_t rc)
+{
+	if (rc < 0) {
 		ERROR("Failed sending mcast to %s: %s", g->group, strerror(errno));
-		g->status[STATUS_POS] = 'E';
-		g->gaps++;
+		hist_set(g, 'E');
+		g->st->gaps += num;
+		top_update(g, num);
+		count_lost(g, num);
 	} else {
-		g->bytes += bytes;
-		g->count++;
-		g->status[STATUS_POS] = '.';
+		g->st->bytes += len;
+		g->st->count += num;
+		agg_count(g, num, len);
+		hist_set(g, '.');
 	}
 }
 
-static void send_cb(int id, void *arg)
+/*
+ * Send one datagram, or with segsz a GSO super-buffer split up by the
+ * kernel.  With zb, buf is one of the group's zerocopy buffers which is
+ * left untouched until the kernel reports it is done with it.
+ */
+static ssize_t send_buf(int sd, struct gr *g, char *buf, size_t len, size_t segsz, struct zcbuf *zb)
 {
-	static int sd4 = -1;
-	static int sd6 = -1;
-	struct gr *g;
+#ifdef UDP_SEGMENT
+	char cmbuf[CMSG_SPACE(sizeof(uint16_t))] = { 0 };
+#endif
+	struct msghdr msgh;
+	struct iovec iov[1];
+
+	iov[0].iov_base = buf;
+	iov[0].iov_len  = len;
+
+	memset(&msgh, 0, sizeof(msgh));
+	msgh.msg_name       = &g->grp;
+	msgh.msg_namelen    = inet_addrlen(&g->grp);
+	msgh.msg_iov        = iov;
+	msgh.msg_iovlen     = NELEMS(iov);
+
+#ifdef UDP_SEGMENT
+	if (segsz) {
+		uint16_t val = segsz;
+		struct cmsghdr *cmsg;
+
+		msgh.msg_control    = cmbuf;
+		msgh.msg_controllen = sizeof(cmbuf);
+
+		cmsg = CMSG_FIRSTHDR(&msgh);
+		cmsg->cmsg_level = SOL_UDP;
+		cmsg->cmsg_type  = UDP_SEGMENT;
+		cmsg->cmsg_len   = CMSG_LEN(sizeof(val));
+		memcpy(CMSG_DATA(cmsg), &val, sizeof(val));
+	}
+#else
+	(void)segsz;
+#endif
+
+	if (zb)
+		return zc_sendmsg(sd, &msgh, zb);
+
+	return sendmsg(sd, &msgh, 0);
+}
+
+/* Send one payload, of the size of its sequence number */
+static void send_one(int sd, struct gr *g)
+{
+	struct zcbuf *zb = NULL;
+	char *buf = sndbuf;
+	size_t len;
+	ssize_t rc;
+
+	if (zerocopy && (zb = zc_get(g)))
+		buf = zb->buf;
+
+	len = sizes_pick(g, g->st->seq);
+	payload(g, buf, len);
+	if (xdp)
+		rc = xdp_send(g, buf, len);
+	else
+		rc = send_buf(sd, g, buf, len, 0, zb);
+	account(g, 1, len, rc);
+}
+
+#ifdef UDP_SEGMENT
+/*
+ * Pack as many of the num payloads as possible in one super-buffer and
+ * let the kernel (or NIC) split it up in datagrams of the group's size.  If
+ * the kernel refuses we disable GSO and send the already built payloads
+ * one by one.  Returns number of payloads handled.
+ */
+static size_t send_gso(int sd, struct gr *g, size_t num)
+{
+	size_t i, max, len = gr_size(g);
+	struct zcbuf *zb = NULL;
+	char *buf = sndbuf;
+	ssize_t rc;
+
+	max = sndlen / len;
+	if (max > GSO_MAX_SEGS)
+		max = GSO_MAX_SEGS;
+	if (!max) {
+		send_one(sd, g);
+		return 1;
+	}
+	if (num > max)
+		num = max;
+
+	if (zerocopy && (zb = zc_get(g)))
+		buf = zb->buf;
+
+	for (i = 0; i < num; i++)
+		payload(g, &buf[i * len], len);
+
+	rc = send_buf(sd, g, buf, num * len, len, zb);
+	if (rc < 0) {
+		switch (errno) {
+		case EINVAL:
+		case EIO:
+		case EMSGSIZE:
+		case ENOPROTOOPT:
+		case EOPNOTSUPP:
+			ERROR("UDP GSO not possible, %s, falling back to sendto().", strerror(errno));
+			offload = 0;
+
+			for (i = 0; i < num; i++) {
+				rc = send_buf(sd, g, &buf[i * len], len, 0, NULL);
+				account(g, 1, len, rc);
+			}
+			return num;
+
+		default:
+			break;
+		}
+	}
+
+	account(g, num, num * len, rc);
+
+	return num;
+}
+#else
+static inline size_t send_gso(int sd, struct gr *g, size_t num)
+{
+	(void)sd;
+	(void)g;
+	(void)num;
+	offload = 0;
+
+	return 0;
+}
+#endif
+
+static void send_mcast(int sd, struct gr *g, size_t num)
+{
+	while (num > 0) {
+		/* GSO segments are all of the same size, at least two per buffer */
+		if (offload && num > 1 && !g->prof.sizes && gr_size(g) <= GSO_MAX_SIZE / 2) {
+			num -= send_gso(sd, g, num);
+			continue;
+		}
+
+		send_one(sd, g);
+		num--;
+	}
+}
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void heap_down(size_t i)
+{
+	while (1) {
+		size_t l = 2 * i + 1, r = l + 1, min = i;
+		struct sclass *tmp;
+
+		if (l < hlen && heap[l]->due < heap[min]->due)
+			min = l;
+		if (r < hlen && heap[r]->due < heap[min]->due)
+			min = r;
+		if (min == i)
+			break;
+
+		tmp       = heap[i];
+		heap[i]   = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+/* Packets per group for n intervals of a class */
+static size_t quota(struct sclass *c, uint64_t n)
+{
+	uint64_t rate = pps >= 0 ? (uint64_t)pps : c->pps;
+	size_t num;
+
+	if (pps < 0 && !c->pps)
+		return n * c->burst;
+
+	c->credit += rate * n * c->interval;
+	num        = c->credit / 1000000;
+	c->credit %= 1000000;
+
+	return num;
+}
+
+/* Send to all groups of a due class, and move it to its next interval */
+static void service(struct sclass *c, uint64_t now)
+{
+	uint64_t n, late;
+	size_t i, num;
+
+	n = (now - c->due) / c->interval + 1;
+	c->due += n * c->interval;
+
+	/* after a stall, do not send more than can be caught up with */
+	late = SCHED_LATE / c->interval + 1;
+	if (n > late)
+		n = late;
+
+	num = quota(c, n);
+	if (count > 0 && num > count - c->sent)
+		num = count - c->sent;
+
+	for (i = 0; i < c->num; i++) {
+		struct gr *g = c->grp[i];
+		int sd = -1;
+
+		if (!xdp) {
+			sd = g->grp.ss_family == AF_INET ? sd4 : sd6;
+			if (sd < 0) {
+				DEBUG("Skipping group %s, no available %s socket.  No address on interface?",
+				      g->group, g->grp.ss_family == AF_INET ? "IPv4" : "IPv6");
+				continue;
+			}
+		}
+
+		send_mcast(sd, g, num);
+	}
+
+	c->sent += num;
+}
+
+static void sched_cb(int id, void *arg)
+{
+	uint64_t now;
 
-	(void)id;
 	(void)arg;
 
-	if (sd4 == -1 && need4)
-		sd4 = send_socket(AF_INET);
+	if (!xdp) {
+		if (sd4 == -1 && need4)
+			sd4 = send_socket(AF_INET);
 #ifdef AF_INET6
-	if (sd6 == -1 && need6)
-		sd6 = send_socket(AF_INET6);
+		if (sd6 == -1 && need6)
+			sd6 = send_socket(AF_INET6);
 #endif
 
-	/* Need at least one socket to send any packet */
-	if (sd4 < 0 && sd6 < 0)
-		pev_exit(1);
+		/* Need at least one socket to send any packet */
+		if (sd4 < 0 && sd6 < 0) {
+			pev_exit(1);
+			return;
+		}
+	}
+
+	now = now_usec();
+	while (hlen && heap[0]->due <= now) {
+		struct sclass *c = heap[0];
+
+		service(c, now);
+		if (count > 0 && c->sent >= count)
+			heap[0] = heap[--hlen];
+		heap_down(0);
+	}
+
+	if (xdp)
+		xdp_flush();
+
+	if (hlen)
+		pev_timer_set(id, heap[0]->due - now);
+	else if (count > 0)
+		pev_exit(0);
+}
+
+static struct sclass *class_get(uint32_t rate, uint32_t num)
+{
+	struct sclass *c, **tmp;
+	size_t i;
+
+	for (i = 0; i < nclass; i++) {
+		c = classes[i];
+		if (c->pps == rate && c->burst == num)
+			return c;
+	}
+
+	tmp = realloc(classes, (nclass + 1) * sizeof(*classes));
+	if (!tmp)
+		return NULL;
+	classes = tmp;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+
+	c->pps   = rate;
+	c->burst = num;
+	if (rate) {
+		c->interval = (uint64_t)num * 1000000 / rate;
+		if (c->interval < SCHED_TICK)
+			c->interval = SCHED_TICK;
+		if (c->interval > SCHED_MAX)
+			c->interval = SCHED_MAX;
+	} else
+		c->interval = period;
+
+	DEBUG("New send class, %u packets/s in bursts of %u, every %lu usec",
+	      rate, num, (unsigned long)c->interval);
+	classes[nclass++] = c;
+
+	return c;
+}
+
+static int class_add(struct sclass *c, struct gr *g)
+{
+	if (c->num == c->max) {
+		size_t max = c->max ? c->max * 2 : 64;
+		struct gr **tmp;
+
+		tmp = realloc(c->grp, max * sizeof(*tmp));
+		if (!tmp)
+			return -1;
+		c->grp = tmp;
+		c->max = max;
+	}
+	c->grp[c->num++] = g;
+
+	return 0;
+}
+
+/* Payload buffer for the largest group, only ever grows */
+static int sndbuf_size(size_t len)
+{
+	char *buf;
+
+	if (offload && len < GSO_MAX_SIZE)
+		len = GSO_MAX_SIZE;
+	if (len <= sndlen)
+		return 0;
+
+	if (posix_memalign((void **)&buf, 64, len)) {
+		ERROR("Failed allocating %zu bytes send buffer: %s", len, strerror(errno));
+		return -1;
+	}
+	free(sndbuf);
+	sndbuf = buf;
+	sndlen = len;
+
+	return 0;
+}
+
+/* Change rate of all groups to pps packets/s, regardless of profile */
+void sender_rate(long rate)
+{
+	size_t i;
+
+	pps = rate;
+	for (i = 0; i < nclass; i++)
+		classes[i]->credit = 0;
+}
+
+/*
+ * Sort groups in classes by their profile, at start and when groups are
+ * added or removed at runtime.  Classes keep their schedule and count.
+ */
+int sender_update(void)
+{
+	struct sclass *c = NULL, **tmp;
+	uint64_t now = now_usec();
+	size_t i, len = 0;
+	struct gr *g;
+
+	for (i = 0; i < nclass; i++)
+		classes[i]->num = 0;
 
 	TAILQ_FOREACH(g, &groups, entry) {
-		int sd;
+		uint32_t num = g->prof.burst ?: burst;
 
-		sd = g->grp.ss_family == AF_INET ? sd4 : sd6;
-		if (sd < 0) {
-			DEBUG("Skipping group %s, no available %s socket.  No address on interface?",
-			      g->group, g->grp.ss_family == AF_INET ? "IPv4" : "IPv6");
-			continue;
+		if (!c || c->pps != g->prof.pps || c->burst != num) {
+			c = class_get(g->prof.pps, num);
+			if (!c)
+				goto fail;
 		}
+		if (class_add(c, g))
+			goto fail;
 
-		send_mcast(sd, g);
+		if (gr_size(g) > len)
+			len = gr_size(g);
 	}
 
-	if (count > 0) {
-		if (!--count)
-			pev_exit(0);
+	if (sndbuf_size(len))
+		return -1;
+	if (zerocopy)
+		zc_update();
+
+	tmp = realloc(heap, (nclass ?: 1) * sizeof(*heap));
+	if (!tmp)
+		goto fail;
+	heap = tmp;
+
+	hlen = 0;
+	for (i = 0; i < nclass; i++) {
+		c = classes[i];
+		if (!c->num || (count > 0 && c->sent >= count))
+			continue;
+
+		/* new, or idle, classes start one interval from now */
+		if (c->due <= now)
+			c->due = now + c->interval;
+		heap[hlen++] = c;
 	}
+	for (i = hlen / 2; i-- > 0; )
+		heap_down(i);
+
+	if (stid >= 0 && hlen)
+		pev_timer_set(stid, heap[0]->due - now);
+
+	return 0;
+fail:
+	ERROR("Failed scheduling groups: %s", strerror(errno));
+	return -1;
 }
 
 int sender_init(void)
 {
-	int rc;
+	size_t len = bytes;
+	struct gr *g;
+
+	TAILQ_FOREACH(g, &groups, entry) {
+		if (gr_size(g) > len)
+			len = gr_size(g);
+	}
+
+	if (xdp && xdp_init(0))
+		xdp = 0;
+	if (xdp && (offload || zerocopy)) {
+		DEBUG("UDP GSO and MSG_ZEROCOPY not used with AF_XDP.");
+		offload = zerocopy = 0;
+	}
+	if (offload && len > GSO_MAX_SIZE / 2) {
+		PRINT("Payload too large for UDP GSO, disabling.");
+		offload = 0;
+	}
+
+	stid = pev_timer_add(period, 0, sched_cb, NULL);
+	if (stid < 0)
+		return 1;
 
-	rc = pev_timer_add(0, period, send_cb, NULL);
-	if (rc < 0)
+	if (sender_update())
 		return 1;
 
 	return 0;
@@ -0,0 +1,195 @@
+/* Shared memory stats segment, for external readers like mcjoin-stat
+ *
+ * Copyright (c) 2008-2025  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The counters are published from a timer, not from the packet path,
+ * which keeps updating the private struct grstat as before.  Only groups
+ * with changes are written, each inside its seqlock, so readers never
+ * need a syscall or see a half updated record.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "mcjoin.h"
+#include "pev.h"
+#include "shm.h"
+
+#define SHM_INTERVAL 100000	/* usec, between publishes */
+
+char *shm_name;			/* -S NAME */
+
+static struct shm_hdr   *hdr;
+static struct shm_group *recs;
+static size_t            shm_size;
+
+static void publish(struct shm_group *r, const struct gr *g)
+{
+	const struct grstat *st = g->st;
+
+	__atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	r->bytes   = st->bytes;
+	r->count   = st->count;
+	r->gaps    = st->gaps;
+	r->lost    = st->lost;
+	r->dupes   = st->dupes;
+	r->order   = st->order;
+	r->delayed = st->delayed;
+	r->invalid = st->invalid;
+	r->rate    = g->rate;
+
+	__atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void shm_cb(int id, void *arg)
+{
+	struct timespec now;
+	struct gr *g;
+	size_t i = 0;
+
+	(void)id;
+	(void)arg;
+
+	if (!hdr)
+		return;
+
+	TAILQ_FOREACH(g, &groups, entry) {
+		struct shm_group *r = &recs[i++];
+
+		if (r->count != g->st->count || r->gaps != g->st->gaps || r->rate != g->rate)
+			publish(r, g);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	__atomic_store_n(&hdr->updated, (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000,
+			 __ATOMIC_RELEASE);
+}
+
+static int shm_rx;
+
+/* Create segment /dev/shm/NAME, with all groups */
+static int segment(void)
+{
+	struct gr *g;
+	size_t i = 0;
+	int fd;
+
+	shm_size = sizeof(*hdr) + group_num * sizeof(*recs);
+
+	fd = shm_open(shm_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto fail;
+
+	if (ftruncate(fd, shm_size)) {
+		close(fd);
+		goto fail;
+	}
+
+	hdr = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		hdr = NULL;
+		goto fail;
+	}
+	recs = (struct shm_group *)&hdr[1];
+
+	TAILQ_FOREACH(g, &groups, entry) {
+		struct shm_group *r = &recs[i++];
+
+		strlcpy(r->source, g->source ?: "*", sizeof(r->source));
+		strlcpy(r->group, g->group, sizeof(r->group));
+	}
+
+	hdr->version  = SHM_VERSION;
+	hdr->hdr_size = sizeof(*hdr);
+	hdr->rec_size = sizeof(*recs);
+	hdr->num      = group_num;
+	hdr->pid      = getpid();
+	hdr->interval = SHM_INTERVAL;
+	hdr->sender   = !shm_rx;
+	__atomic_store_n(&hdr->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return 0;
+fail:
+	ERROR("Failed setting up shared memory stats %s: %s", shm_name, strerror(errno));
+	return 1;
+}
+
+int shm_init(int rx)
+{
+	if (!shm_name)
+		return 0;
+
+	shm_rx = rx;
+	if (segment())
+		return 1;
+
+	if (pev_timer_add(0, SHM_INTERVAL, shm_cb, NULL) < 0) {
+		ERROR("Failed setting up shared memory stats %s: %s", shm_name, strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Groups added or removed at runtime, replace the segment.  Readers of
+ * the old one keep their mapping, which is marked stale, they must open
+ * NAME again to see the new set of groups.
+ */
+int shm_update(void)
+{
+	if (!hdr)
+		return 0;
+
+	__atomic_store_n(&hdr->magic, 0, __ATOMIC_RELEASE);
+	shm_unlink(shm_name);
+	munmap(hdr, shm_size);
+	hdr = NULL;
+	recs = NULL;
+
+	return segment();
+}
+
+/* Readers keep their mapping, new readers cannot find a stale segment */
+void shm_exit(void)
+{
+	if (!hdr)
+		return;
+
+	shm_cb(0, NULL);
+	shm_unlink(shm_name);
+	munmap(hdr, shm_size);
+	hdr = NULL;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2008-2025  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MCJOIN_SHM_H_
+#define MCJOIN_SHM_H_
+
+#include <stdint.h>
+
+/*
+ * Layout of the shared memory stats segment, see shm.c and mcjoin-stat.
+ * A header followed by one record per group.  Readers must check magic,
+ * version, and use hdr_size and rec_size to step, new fields are only
+ * added at the end.  Each record is protected by a seqlock, seq is odd
+ * while the record is updated.  When groups change at runtime magic is
+ * cleared, and readers must open the segment again.
+ */
+#define SHM_MAGIC    0x6d636a6e	/* "mcjn" */
+#define SHM_VERSION  1
+#define SHM_NAMELEN  48		/* INET6_ADDRSTRLEN, rounded up */
+
+struct shm_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t hdr_size;
+	uint32_t rec_size;
+	uint64_t num;		/* number of records */
+	uint64_t pid;
+	uint64_t updated;	/* usec since epoch, last publish */
+	uint32_t interval;	/* usec, between publishes */
+	uint32_t sender;	/* 1 if counters are of a sender */
+};
+
+struct shm_group {
+	uint32_t seq;
+	uint32_t pad;
+	char     source[SHM_NAMELEN];	/* "*" for ASM */
+	char     group[SHM_NAMELEN];
+	uint64_t bytes;
+	uint64_t count;
+	uint64_t gaps;
+	uint64_t lost;
+	uint64_t dupes;
+	uint64_t order;
+	uint64_t delayed;
+	uint64_t invalid;
+	uint64_t rate;		/* bytes/sec, 5 sec average */
+};
+
+#endif /* MCJOIN_SHM_H_ */
@@ -0,0 +1,359 @@
+/* Payload size distributions of groups, and receive stats per size
+ *
+ * Copyright (c) 2008-2025  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A distribution is a weighted mix of sizes, e.g., IMIX, or a sweep in
+ * steps from a first to a last size.  The size of each packet is given
+ * by the group and the sequence number, not by any state, so runs are
+ * repeatable, and a receiver with the same distribution for a group
+ * knows the size of each packet it has lost.
+ *
+ * The receiver counts packets per size bucket, one for each size of the
+ * distributions of its groups, or power of two ranges if there are none,
+ * or too many sizes.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "mcjoin.h"
+
+#define SIZES_MAX    16		/* sizes in a mix */
+#define BUCKET_MAX   64
+#define LOST_MAX     65536	/* lost packets of one gap attributed to sizes */
+
+/* Simple IMIX, 7:4:1 of 64, 594, and 1518 byte frames, as UDP/IPv4 payload */
+#define IMIX         "18:7,548:4,1472:1"
+
+struct sizes {
+	struct sizes *next;
+	uint32_t      num;
+	uint32_t      step;	/* sweep from size[0], 0 for a mix */
+	uint32_t      total;	/* sum of weights */
+	uint32_t      max;
+	uint32_t      size[SIZES_MAX];
+	uint32_t      weight[SIZES_MAX];	/* cumulative */
+	char          name[];
+};
+
+struct bucket {
+	uint32_t      lo;	/* smallest size */
+	uint64_t      count;
+	uint64_t      bytes;
+	uint64_t      lost;
+};
+
+static struct sizes  *dists;	/* interned, never freed */
+static struct bucket  buckets[BUCKET_MAX + 1];	/* last for other sizes */
+static size_t         nbucket;
+static int            exact;	/* one bucket per size */
+
+/* FIRST-LAST[/STEP], or SIZE[:WEIGHT],... */
+static int parse(struct sizes *d, const char *arg)
+{
+	unsigned long size, weight;
+	char *end;
+
+	if (!strcmp(arg, "imix"))
+		arg = IMIX;
+
+	if (strchr(arg, '-')) {
+		unsigned long last, step = 1;
+
+		size = strtoul(arg, &end, 10);
+		if (end == arg || *end != '-')
+			return -1;
+		last = strtoul(end + 1, &end, 10);
+		if (*end == '/')
+			step = strtoul(end + 1, &end, 10);
+		if (*end || size < PAYLOAD_MIN || last > PAYLOAD_MAX || last < size || step < 1)
+			return -1;
+
+		d->size[0] = size;
+		d->step    = step;
+		d->num     = (last - size) / step + 1;
+		d->max     = size + (d->num - 1) * step;
+		return 0;
+	}
+
+	while (1) {
+		size = strtoul(arg, &end, 10);
+		if (end == arg || size < PAYLOAD_MIN || size > PAYLOAD_MAX || d->num == SIZES_MAX)
+			return -1;
+
+		weight = 1;
+		if (*end == ':') {
+			arg = end + 1;
+			weight = strtoul(arg, &end, 10);
+			if (end == arg || weight < 1 || weight > 1000)
+				return -1;
+		}
+
+		d->total += weight;
+		d->size[d->num]     = size;
+		d->weight[d->num++] = d->total;
+		if (size > d->max)
+			d->max = size;
+
+		if (!*end)
+			break;
+		if (*end != ',')
+			return -1;
+		arg = end + 1;
+	}
+
+	return 0;
+}
+
+/* Distribution of arg, same for all groups with it, NULL if invalid */
+const struct sizes *sizes_get(const char *arg)
+{
+	struct sizes *d;
+	size_t len;
+
+	for (d = dists; d; d = d->next) {
+		if (!strcmp(d->name, arg))
+			return d;
+	}
+
+	len = strlen(arg) + 1;
+	d = calloc(1, sizeof(*d) + len);
+	if (!d)
+		return NULL;
+	memcpy(d->name, arg, len);
+
+	if (parse(d, arg)) {
+		free(d);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	d->next = dists;
+	dists   = d;
+
+	return d;
+}
+
+size_t sizes_max(const struct sizes *d)
+{
+	return d->max;
+}
+
+/* Last 32 bits of the group, so groups of a range get different sizes */
+static uint64_t seed(const struct gr *g)
+{
+	uint32_t val;
+
+#ifdef AF_INET6
+	if (g->grp.ss_family == AF_INET6) {
+		memcpy(&val, &((const struct sockaddr_in6 *)&g->grp)->sin6_addr.s6_addr[12], sizeof(val));
+		return val;
+	}
+#endif
+	val = ((const struct sockaddr_in *)&g->grp)->sin_addr.s_addr;
+
+	return val;
+}
+
+/* Finalizer of SplitMix64, every bit of x affects every bit of the result */
+static uint64_t mix(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+	return x ^ (x >> 31);
+}
+
+/* Payload size of packet seq of a group */
+size_t sizes_pick(const struct gr *g, size_t seq)
+{
+	const struct sizes *d = g->prof.sizes;
+	uint32_t r;
+	size_t i;
+
+	if (!d)
+		return gr_size(g);
+	if (d->step)
+		return d->size[0] + (seq % d->num) * d->step;
+	if (d->num == 1)
+		return d->size[0];
+
+	r = mix((seed(g) << 32 ^ seq) + 0x9e3779b97f4a7c15ULL) % d->total;
+	for (i = 0; r >= d->weight[i]; i++)
+		;
+
+	return d->size[i];
+}
+
+/* Add bucket for size, sorted, returns -1 if full */
+static int bucket_add(uint32_t size)
+{
+	size_t i;
+
+	for (i = 0; i < nbucket && buckets[i].lo < size; i++)
+		;
+	if (i < nbucket && buckets[i].lo == size)
+		return 0;
+	if (nbucket == BUCKET_MAX)
+		return -1;
+
+	memmove(&buckets[i + 1], &buckets[i], (nbucket - i) * sizeof(buckets[0]));
+	buckets[i].lo = size;
+	nbucket++;
+
+	return 0;
+}
+
+/*
+ * Set up buckets from the sizes of the groups, called once when the
+ * receiver starts.  Sizes of groups added at runtime, and not already
+ * in a bucket, are counted as other, or in their power of two range.
+ */
+void sizes_init(void)
+{
+	const struct sizes *prev = NULL;
+	struct gr *g;
+	int full = 0;
+	uint32_t lo;
+
+	TAILQ_FOREACH(g, &groups, entry) {
+		const struct sizes *d = g->prof.sizes;
+		uint32_t i;
+
+		if (!g->prof.size || (d && d == prev))
+			continue;
+		if (!d) {
+			full |= bucket_add(g->prof.size);
+			continue;
+		}
+
+		for (i = 0; i < d->num; i++)
+			full |= bucket_add(d->step ? d->size[0] + i * d->step : d->size[i]);
+		prev = d;
+	}
+
+	if (nbucket && !full) {
+		exact = 1;
+		return;
+	}
+
+	memset(buckets, 0, sizeof(buckets));
+	nbucket = 0;
+	buckets[nbucket++].lo = 0;
+	for (lo = 64; lo <= PAYLOAD_MAX; lo *= 2)
+		buckets[nbucket++].lo = lo;
+}
+
+static struct bucket *bucket(size_t size)
+{
+	size_t lo = 0, hi = nbucket;
+
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+
+		if (buckets[mid].lo <= size)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	if (exact && buckets[lo].lo != size)
+		return &buckets[BUCKET_MAX];
+
+	return &buckets[lo];
+}
+
+/* Called on every packet received, size is that of the datagram */
+void sizes_rx(size_t size)
+{
+	struct bucket *b;
+
+	if (!nbucket)
+		return;
+
+	b = bucket(size);
+	b->count++;
+	b->bytes += size;
+}
+
+/* Packets seq to seq + num - 1 of group lost, only known with a size */
+void sizes_lost(const struct gr *g, size_t seq, size_t num)
+{
+	size_t i;
+
+	if (!nbucket || !g->prof.size)
+		return;
+
+	if (!g->prof.sizes) {
+		bucket(g->prof.size)->lost += num;
+		return;
+	}
+
+	/* huge gaps, e.g., a sender restart, are not worth the time */
+	if (num > LOST_MAX)
+		num = LOST_MAX;
+	for (i = 0; i < num; i++)
+		bucket(sizes_pick(g, seq + i))->lost++;
+}
+
+/* At exit, packets, loss, and rate of each size, over secs */
+void sizes_show(unsigned long secs)
+{
+	size_t i, used = 0;
+
+	for (i = 0; i <= BUCKET_MAX; i++) {
+		if (buckets[i].count || buckets[i].lost)
+			used++;
+	}
+	if (!used || (used == 1 && !exact))
+		return;
+	if (!secs)
+		secs = 1;
+
+	for (i = 0; i <= BUCKET_MAX; i++) {
+		const struct bucket *b = &buckets[i];
+		char name[16];
+
+		if (!b->count && !b->lost)
+			continue;
+
+		if (i == BUCKET_MAX)
+			strlcpy(name, "other", sizeof(name));
+		else if (exact)
+			snprintf(name, sizeof(name), "%u", b->lo);
+		else
+			snprintf(name, sizeof(name), "%u-%u", b->lo,
+				 i + 1 < nbucket ? buckets[i + 1].lo - 1 : PAYLOAD_MAX);
+
+		PRINT("Size %-11s: packets %-10" PRIu64 " lost %-8" PRIu64 " loss %6.2f%%  %9.1f pps %9.1f kbps",
+		      name, b->count, b->lost, 100.0 * b->lost / (b->count + b->lost),
+		      (double)b->count / secs, b->bytes * 8.0 / 1000 / secs);
+	}
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
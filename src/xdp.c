@@ -0,0 +1,824 @@
+/* AF_XDP send/receive engine, Linux only
+ *
+ * Copyright (c) 2008-2025  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * One XDP socket (XSK) is bound to queue 0 of the interface given with
+ * -i.  The UMEM is split in two halves, the first is handed to the
+ * kernel in the fill ring for reception, the second is a free list of
+ * frames used for transmission.  The receiver loads a tiny XDP program
+ * that redirects UDP multicast to the XSK, everything else, e.g. ARP and
+ * IGMP, is passed on to the kernel as usual.  The kernel picks native
+ * (driver) mode if possible, otherwise generic mode, which means this
+ * works on a plain veth pair as well.
+ *
+ * No libbpf/libxdp dependency, we use the raw kernel API.  Any failure
+ * during setup is reported and the caller falls back to regular sockets.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#include "mcjoin.h"
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define NUM_FRAMES   2048
+#define FRAME_SIZE   2048
+#define RING_SIZE    (NUM_FRAMES / 2)
+#define BATCH_SIZE   64
+
+#define ETH_HLEN     14
+#define IP_HLEN      20
+#define IP6_HLEN     40
+#define UDP_HLEN     8
+
+struct ring {
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void     *desc;
+	uint32_t  mask;
+	void     *map;
+	size_t    maplen;
+};
+
+static struct {
+	int          fd;
+	int          map_fd;
+	int          prog_fd;
+	int          link_fd;
+	int          ifindex;
+
+	uint8_t     *umem;
+	struct ring  fq, cq, rx, tx;
+
+	uint64_t     frames[RING_SIZE]; /* free TX frames */
+	uint32_t     nfree;
+	uint32_t     pending;	/* TX descriptors not yet kicked */
+
+	uint8_t      mac[6];
+	inet_addr_t  src4;
+	inet_addr_t  src6;
+	uint16_t     ipid;
+
+	struct gr  **tbl;	/* RX demux, open addressing */
+	size_t       tblsz;
+} xsk = { .fd = -1, .map_fd = -1, .prog_fd = -1, .link_fd = -1 };
+
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*
+ * XDP program, redirect IPv4/IPv6 UDP to a multicast MAC to our XSK,
+ * all IPv4 fragments, first or not, and everything else is passed to the
+ * stack.
+ */
+#define INSN(c, d, s, o, i) ((struct bpf_insn){ .code = c, .dst_reg = d, .src_reg = s, .off = o, .imm = i })
+#define MOV_REG(d, s)       INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define MOV_IMM(d, i)       INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define ALU_IMM(op, d, i)   INSN(BPF_ALU64 | op | BPF_K, d, 0, 0, i)
+#define LDX(sz, d, s, o)    INSN(BPF_LDX | sz | BPF_MEM, d, s, o, 0)
+#define JMP_REG(op, d, s, o) INSN(BPF_JMP | op | BPF_X, d, s, o, 0)
+#define JMP_IMM(op, d, i, o) INSN(BPF_JMP | op | BPF_K, d, 0, o, i)
+#define JA(o)               INSN(BPF_JMP | BPF_JA, 0, 0, o, 0)
+#define CALL(f)             INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define EXIT()              INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+#define LD_MAP(d, fd)       INSN(BPF_LD | BPF_DW | BPF_IMM, d, BPF_PSEUDO_MAP_FD, 0, fd), INSN(0, 0, 0, 0, 0)
+
+/* Jump offset from instruction at @pc to label @to */
+#define J(pc, to)           ((to) - (pc) - 1)
+#define L_V4                13
+#define L_V6                19
+#define L_REDIRECT          24
+#define L_PASS              30
+
+static int prog_load(int map_fd)
+{
+	struct bpf_insn prog[] = {
+		/*  0 */ MOV_REG(BPF_REG_6, BPF_REG_1),
+		/*  1 */ LDX(BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data)),
+		/*  2 */ LDX(BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end)),
+		/*  3 */ MOV_REG(BPF_REG_4, BPF_REG_2),
+		/*  4 */ ALU_IMM(BPF_ADD, BPF_REG_4, ETH_HLEN + IP_HLEN),
+		/*  5 */ JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, J(5, L_PASS)),
+		/*  6 */ LDX(BPF_B, BPF_REG_5, BPF_REG_2, 0),
+		/*  7 */ ALU_IMM(BPF_AND, BPF_REG_5, 1),
+		/*  8 */ JMP_IMM(BPF_JEQ, BPF_REG_5, 0, J(8, L_PASS)),
+		/*  9 */ LDX(BPF_H, BPF_REG_5, BPF_REG_2, 12),
+		/* 10 */ JMP_IMM(BPF_JEQ, BPF_REG_5, htons(0x0800), J(10, L_V4)),
+		/* 11 */ JMP_IMM(BPF_JEQ, BPF_REG_5, htons(0x86DD), J(11, L_V6)),
+		/* 12 */ JA(J(12, L_PASS)),
+		/* 13 */ LDX(BPF_B, BPF_REG_5, BPF_REG_2, ETH_HLEN + 9),
+		/* 14 */ JMP_IMM(BPF_JNE, BPF_REG_5, IPPROTO_UDP, J(14, L_PASS)),
+		/* 15 */ LDX(BPF_H, BPF_REG_5, BPF_REG_2, ETH_HLEN + 6),
+		/* 16 */ ALU_IMM(BPF_AND, BPF_REG_5, htons(0x3fff)),
+		/* 17 */ JMP_IMM(BPF_JNE, BPF_REG_5, 0, J(17, L_PASS)),
+		/* 18 */ JA(J(18, L_REDIRECT)),
+		/* 19 */ MOV_REG(BPF_REG_4, BPF_REG_2),
+		/* 20 */ ALU_IMM(BPF_ADD, BPF_REG_4, ETH_HLEN + IP6_HLEN),
+		/* 21 */ JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, J(21, L_PASS)),
+		/* 22 */ LDX(BPF_B, BPF_REG_5, BPF_REG_2, ETH_HLEN + 6),
+		/* 23 */ JMP_IMM(BPF_JNE, BPF_REG_5, IPPROTO_UDP, J(23, L_PASS)),
+		/* 24 */ LDX(BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index)),
+		/* 25 */ LD_MAP(BPF_REG_1, map_fd),
+		/* 27 */ MOV_IMM(BPF_REG_3, XDP_PASS),
+		/* 28 */ CALL(BPF_FUNC_redirect_map),
+		/* 29 */ EXIT(),
+		/* 30 */ MOV_IMM(BPF_REG_0, XDP_PASS),
+		/* 31 */ EXIT(),
+	};
+	static char log[4096];
+	union bpf_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns     = (uintptr_t)prog;
+	attr.insn_cnt  = NELEMS(prog);
+	attr.license   = (uintptr_t)"ISC";
+	attr.log_buf   = (uintptr_t)log;
+	attr.log_size  = sizeof(log);
+	attr.log_level = 1;
+
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd < 0)
+		DEBUG("XDP program rejected by verifier:\n%s", log);
+
+	return fd;
+}
+
+static int map_create(void)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type    = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size    = sizeof(int);
+	attr.value_size  = sizeof(int);
+	attr.max_entries = 1;
+
+	return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int map_update(int map_fd, int key, int val)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	attr.key    = (uintptr_t)&key;
+	attr.value  = (uintptr_t)&val;
+	attr.flags  = BPF_ANY;
+
+	return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+/* Try native (driver) mode first, then generic (skb) mode */
+static int prog_attach(int prog_fd, int ifindex)
+{
+	const unsigned int modes[] = { XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE };
+	union bpf_attr attr;
+	size_t i;
+	int fd = -1;
+
+	for (i = 0; i < NELEMS(modes); i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.link_create.prog_fd        = prog_fd;
+		attr.link_create.target_ifindex = ifindex;
+		attr.link_create.attach_type    = BPF_XDP;
+		attr.link_create.flags          = modes[i];
+
+		fd = sys_bpf(BPF_LINK_CREATE, &attr);
+		if (fd >= 0) {
+			DEBUG("XDP program attached to %s in %s mode", iface,
+			      modes[i] == XDP_FLAGS_DRV_MODE ? "native" : "generic");
+			break;
+		}
+	}
+
+	return fd;
+}
+
+static int ring_map(struct ring *r, int type, off_t pgoff, struct xdp_ring_offset *off, size_t descsz)
+{
+	int num = RING_SIZE;
+	uint8_t *map;
+
+	if (setsockopt(xsk.fd, SOL_XDP, type, &num, sizeof(num)))
+		return -1;
+
+	r->maplen = off->desc + RING_SIZE * descsz;
+	map = mmap(NULL, r->maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, xsk.fd, pgoff);
+	if (map == MAP_FAILED) {
+		r->map = NULL;
+		return -1;
+	}
+
+	r->map      = map;
+	r->producer = (uint32_t *)(map + off->producer);
+	r->consumer = (uint32_t *)(map + off->consumer);
+	r->flags    = (uint32_t *)(map + off->flags);
+	r->desc     = map + off->desc;
+	r->mask     = RING_SIZE - 1;
+
+	return 0;
+}
+
+static uint32_t ring_ready(struct ring *r)
+{
+	return __atomic_load_n(r->producer, __ATOMIC_ACQUIRE) - *r->consumer;
+}
+
+static int umem_init(int rx)
+{
+	struct xdp_umem_reg reg = { 0 };
+	struct xdp_mmap_offsets off;
+	socklen_t len = sizeof(off);
+	uint32_t i;
+
+	xsk.umem = mmap(NULL, NUM_FRAMES * FRAME_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (xsk.umem == MAP_FAILED) {
+		xsk.umem = NULL;
+		return -1;
+	}
+
+	reg.addr       = (uintptr_t)xsk.umem;
+	reg.len        = NUM_FRAMES * FRAME_SIZE;
+	reg.chunk_size = FRAME_SIZE;
+	if (setsockopt(xsk.fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)))
+		return -1;
+
+	if (getsockopt(xsk.fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len))
+		return -1;
+
+	if (ring_map(&xsk.fq, XDP_UMEM_FILL_RING, XDP_UMEM_PGOFF_FILL_RING, &off.fr, sizeof(uint64_t)) ||
+	    ring_map(&xsk.cq, XDP_UMEM_COMPLETION_RING, XDP_UMEM_PGOFF_COMPLETION_RING, &off.cr, sizeof(uint64_t)))
+		return -1;
+
+	if (rx && ring_map(&xsk.rx, XDP_RX_RING, XDP_PGOFF_RX_RING, &off.rx, sizeof(struct xdp_desc)))
+		return -1;
+	if (ring_map(&xsk.tx, XDP_TX_RING, XDP_PGOFF_TX_RING, &off.tx, sizeof(struct xdp_desc)))
+		return -1;
+
+	/* First half of UMEM for RX, second half for TX */
+	if (rx) {
+		uint64_t *fq = xsk.fq.desc;
+
+		for (i = 0; i < RING_SIZE; i++)
+			fq[i] = (uint64_t)i * FRAME_SIZE;
+		__atomic_store_n(xsk.fq.producer, RING_SIZE, __ATOMIC_RELEASE);
+	}
+
+	for (i = 0; i < RING_SIZE; i++)
+		xsk.frames[i] = (uint64_t)(RING_SIZE + i) * FRAME_SIZE;
+	xsk.nfree = RING_SIZE;
+
+	return 0;
+}
+
+static void busy_poll(int fd)
+{
+	int val;
+
+#ifdef SO_PREFER_BUSY_POLL
+	val = 1;
+	if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &val, sizeof(val)))
+		DEBUG("Failed enabling SO_PREFER_BUSY_POLL: %s", strerror(errno));
+#endif
+#ifdef SO_BUSY_POLL
+	val = 20;
+	if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val)))
+		DEBUG("Failed setting SO_BUSY_POLL: %s", strerror(errno));
+#endif
+#ifdef SO_BUSY_POLL_BUDGET
+	val = BATCH_SIZE;
+	if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &val, sizeof(val)))
+		DEBUG("Failed setting SO_BUSY_POLL_BUDGET: %s", strerror(errno));
+#endif
+	(void)val;
+}
+
+static int hwaddr(const char *ifname, uint8_t *mac)
+{
+	struct ifreq ifr;
+	int sd, rc;
+
+	sd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sd < 0)
+		return -1;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name));
+	rc = ioctl(sd, SIOCGIFHWADDR, &ifr);
+	if (!rc)
+		memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+	close(sd);
+
+	return rc;
+}
+
+/*
+ * RX demux table, keyed on destination group and port.  Several (S,G)
+ * with the same group land in the same chain, source is checked on
+ * lookup since XDP bypasses the kernel's source filtering.
+ */
+static size_t addr_hash(int family, const uint8_t *addr, uint16_t port)
+{
+	size_t len = family == AF_INET ? 4 : 16;
+	uint32_t h = 2166136261u ^ port;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ addr[i]) * 16777619u;
+
+	return h;
+}
+
+static const uint8_t *gr_addr(const inet_addr_t *ss)
+{
+#ifdef AF_INET6
+	if (ss->ss_family == AF_INET6)
+		return ((const struct sockaddr_in6 *)ss)->sin6_addr.s6_addr;
+#endif
+	return (const uint8_t *)&((const struct sockaddr_in *)ss)->sin_addr;
+}
+
+static int tbl_init(void)
+{
+	struct gr *g;
+
+	xsk.tblsz = 64;
+	while (xsk.tblsz < group_num * 2)
+		xsk.tblsz <<= 1;
+
+	xsk.tbl = calloc(xsk.tblsz, sizeof(struct gr *));
+	if (!xsk.tbl)
+		return -1;
+
+	TAILQ_FOREACH(g, &groups, entry) {
+		size_t i;
+
+		i = addr_hash(g->grp.ss_family, gr_addr(&g->grp), inet_addr_get_port(&g->grp));
+		while (xsk.tbl[i & (xsk.tblsz - 1)])
+			i++;
+		xsk.tbl[i & (xsk.tblsz - 1)] = g;
+	}
+
+	return 0;
+}
+
+/* Rebuild the group table when groups have been added or removed */
+int xdp_update(void)
+{
+	struct gr **tbl = xsk.tbl;
+	size_t tblsz = xsk.tblsz;
+
+	if (!tbl)
+		return 0;
+
+	/* keep the old table if there is no room for a new */
+	if (tbl_init()) {
+		ERROR("Failed allocating AF_XDP group table: %s", strerror(errno));
+		xsk.tbl   = tbl;
+		xsk.tblsz = tblsz;
+		return -1;
+	}
+	free(tbl);
+
+	return 0;
+}
+
+static struct gr *tbl_find(int family, const uint8_t *src, const uint8_t *dst, uint16_t port)
+{
+	size_t len = family == AF_INET ? 4 : 16;
+	struct gr *g;
+	size_t i;
+
+	i = addr_hash(family, dst, port);
+	while ((g = xsk.tbl[i++ & (xsk.tblsz - 1)])) {
+		if (g->grp.ss_family != family || (uint16_t)inet_addr_get_port(&g->grp) != port)
+			continue;
+		if (memcmp(gr_addr(&g->grp), dst, len))
+			continue;
+		if (g->source && memcmp(gr_addr(&g->src), src, len))
+			continue;
+
+		return g;
+	}
+
+	return NULL;
+}
+
+static void rx_frame(uint8_t *pkt, uint32_t len)
+{
+	const uint8_t *src, *dst;
+	struct gr *g;
+	uint16_t type, dport, ulen;
+	uint8_t *udp;
+	int family;
+
+	if (len < ETH_HLEN + IP_HLEN + UDP_HLEN)
+		return;
+
+	memcpy(&type, &pkt[12], sizeof(type));
+	if (type == htons(0x0800)) {
+		uint8_t *ip = &pkt[ETH_HLEN];
+		size_t ihl = (ip[0] & 0x0f) * 4;
+
+		if (ihl < IP_HLEN || len < ETH_HLEN + ihl + UDP_HLEN)
+			return;
+
+		family = AF_INET;
+		src = &ip[12];
+		dst = &ip[16];
+		udp = &ip[ihl];
+	} else if (type == htons(0x86DD)) {
+		uint8_t *ip6 = &pkt[ETH_HLEN];
+
+		if (len < ETH_HLEN + IP6_HLEN + UDP_HLEN)
+			return;
+
+		family = AF_INET6;
+		src = &ip6[8];
+		dst = &ip6[24];
+		udp = &ip6[IP6_HLEN];
+	} else
+		return;
+
+	memcpy(&dport, &udp[2], sizeof(dport));
+	memcpy(&ulen, &udp[4], sizeof(ulen));
+	ulen = ntohs(ulen);
+	if (ulen < UDP_HLEN || udp + ulen > pkt + len)
+		return;
+
+	g = tbl_find(family, src, dst, dport);
+	if (!g)
+		return;
+
+	recv_payload(g, (char *)&udp[UDP_HLEN], ulen - UDP_HLEN, ulen - UDP_HLEN);
+}
+
+static void rx_cb(int sd, void *arg)
+{
+	struct xdp_desc *rx = xsk.rx.desc;
+	uint64_t *fq = xsk.fq.desc;
+	uint32_t i, n, cons, prod;
+
+	(void)arg;
+
+	n = ring_ready(&xsk.rx);
+	if (n > BATCH_SIZE)
+		n = BATCH_SIZE;
+
+	cons = *xsk.rx.consumer;
+	prod = *xsk.fq.producer;
+	for (i = 0; i < n; i++) {
+		const struct xdp_desc *d = &rx[(cons + i) & xsk.rx.mask];
+		uint64_t base = d->addr & ~(uint64_t)(FRAME_SIZE - 1);
+
+		/* recv_payload() NUL terminates, leave room for it */
+		if ((d->addr - base) + d->len < FRAME_SIZE)
+			rx_frame(xsk.umem + d->addr, d->len);
+
+		fq[(prod + i) & xsk.fq.mask] = base;
+	}
+	__atomic_store_n(xsk.rx.consumer, cons + n, __ATOMIC_RELEASE);
+	__atomic_store_n(xsk.fq.producer, prod + n, __ATOMIC_RELEASE);
+
+	if (*xsk.fq.flags & XDP_RING_NEED_WAKEUP)
+		recvfrom(sd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+
+	if (count > 0)
+		receiver_check();
+}
+
+static void tx_reap(void)
+{
+	uint64_t *cq = xsk.cq.desc;
+	uint32_t i, n, cons;
+
+	n = ring_ready(&xsk.cq);
+	cons = *xsk.cq.consumer;
+	for (i = 0; i < n; i++)
+		xsk.frames[xsk.nfree++] = cq[(cons + i) & xsk.cq.mask];
+	__atomic_store_n(xsk.cq.consumer, cons + n, __ATOMIC_RELEASE);
+}
+
+static uint32_t csum_add(uint32_t sum, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len > 1) {
+		sum += (p[0] << 8) | p[1];
+		p   += 2;
+		len -= 2;
+	}
+	if (len)
+		sum += p[0] << 8;
+
+	return sum;
+}
+
+static uint16_t csum_fold(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return htons(~sum & 0xffff);
+}
+
+static size_t tx_build(uint8_t *pkt, struct gr *g, const char *buf, size_t len)
+{
+	const uint8_t *dst = gr_addr(&g->grp);
+	uint16_t port = inet_addr_get_port(&g->grp);
+	uint16_t ulen = UDP_HLEN + len;
+	uint8_t *ip, *udp;
+	uint32_t sum;
+	uint16_t csum;
+	size_t alen;
+
+	memcpy(&pkt[6], xsk.mac, 6);
+	ip = &pkt[ETH_HLEN];
+	if (g->grp.ss_family == AF_INET) {
+		/* RFC1112: 01:00:5e + low 23 bits of group */
+		pkt[0] = 0x01; pkt[1] = 0x00; pkt[2] = 0x5e;
+		pkt[3] = dst[1] & 0x7f; pkt[4] = dst[2]; pkt[5] = dst[3];
+		pkt[12] = 0x08; pkt[13] = 0x00;
+
+		memset(ip, 0, IP_HLEN);
+		ip[0] = 0x45;
+		ip[2] = (IP_HLEN + ulen) >> 8;
+		ip[3] = (IP_HLEN + ulen) & 0xff;
+		ip[4] = xsk.ipid >> 8;
+		ip[5] = xsk.ipid++ & 0xff;
+		ip[8] = ttl;
+		ip[9] = IPPROTO_UDP;
+		memcpy(&ip[12], gr_addr(&xsk.src4), 4);
+		memcpy(&ip[16], dst, 4);
+		csum = csum_fold(csum_add(0, ip, IP_HLEN));
+		memcpy(&ip[10], &csum, sizeof(csum));
+
+		udp  = &ip[IP_HLEN];
+		alen = 4;
+	} else {
+		/* RFC2464: 33:33 + low 32 bits of group */
+		pkt[0] = 0x33; pkt[1] = 0x33;
+		memcpy(&pkt[2], &dst[12], 4);
+		pkt[12] = 0x86; pkt[13] = 0xdd;
+
+		memset(ip, 0, IP6_HLEN);
+		ip[0] = 0x60;
+		ip[4] = ulen >> 8;
+		ip[5] = ulen & 0xff;
+		ip[6] = IPPROTO_UDP;
+		ip[7] = ttl;
+		memcpy(&ip[8], gr_addr(&xsk.src6), 16);
+		memcpy(&ip[24], dst, 16);
+
+		udp  = &ip[IP6_HLEN];
+		alen = 16;
+	}
+
+	memcpy(&udp[0], &port, sizeof(port));
+	memcpy(&udp[2], &port, sizeof(port));
+	udp[4] = ulen >> 8;
+	udp[5] = ulen & 0xff;
+	udp[6] = udp[7] = 0;
+	memcpy(&udp[UDP_HLEN], buf, len);
+
+	/* Pseudo header, mandatory for IPv6 */
+	sum = csum_add(0, udp - 2 * alen, 2 * alen);
+	sum += IPPROTO_UDP + ulen;
+	sum = csum_add(sum, udp, ulen);
+	csum = csum_fold(sum);
+	if (!csum)
+		csum = 0xffff;
+	memcpy(&udp[6], &csum, sizeof(csum));
+
+	return udp + ulen - pkt;
+}
+
+/*
+ * Queue one datagram on the TX ring, descriptors are batched until the
+ * next xdp_flush().
+ */
+int xdp_send(struct gr *g, const char *buf, size_t len)
+{
+	struct xdp_desc *tx = xsk.tx.desc;
+	struct xdp_desc *d;
+	uint64_t addr;
+
+	if (ETH_HLEN + IP6_HLEN + UDP_HLEN + len > FRAME_SIZE) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	/* As many TX frames as ring slots, a free frame means a free slot */
+	if (!xsk.nfree) {
+		xdp_flush();
+		if (!xsk.nfree) {
+			errno = ENOBUFS;
+			return -1;
+		}
+	}
+
+	addr = xsk.frames[--xsk.nfree];
+	d = &tx[(*xsk.tx.producer + xsk.pending) & xsk.tx.mask];
+	d->addr    = addr;
+	d->len     = tx_build(xsk.umem + addr, g, buf, len);
+	d->options = 0;
+	xsk.pending++;
+
+	if (xsk.pending >= BATCH_SIZE)
+		xdp_flush();
+
+	return 0;
+}
+
+void xdp_flush(void)
+{
+	if (xsk.pending) {
+		__atomic_store_n(xsk.tx.producer, *xsk.tx.producer + xsk.pending, __ATOMIC_RELEASE);
+		xsk.pending = 0;
+	}
+
+	if (*xsk.tx.flags & XDP_RING_NEED_WAKEUP) {
+		if (sendto(xsk.fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+		    errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+			TRACE(TRACE_XDP, "Failed kicking XDP TX: %s", strerror(errno));
+	}
+
+	tx_reap();
+}
+
+void xdp_exit(void)
+{
+	struct ring *rings[] = { &xsk.fq, &xsk.cq, &xsk.rx, &xsk.tx };
+	size_t i;
+
+	if (xsk.link_fd >= 0)
+		close(xsk.link_fd);
+	if (xsk.prog_fd >= 0)
+		close(xsk.prog_fd);
+	if (xsk.map_fd >= 0)
+		close(xsk.map_fd);
+	if (xsk.fd >= 0)
+		close(xsk.fd);
+
+	for (i = 0; i < NELEMS(rings); i++) {
+		if (rings[i]->map)
+			munmap(rings[i]->map, rings[i]->maplen);
+		rings[i]->map = NULL;
+	}
+	if (xsk.umem)
+		munmap(xsk.umem, NUM_FRAMES * FRAME_SIZE);
+	free(xsk.tbl);
+
+	memset(&xsk, 0, sizeof(xsk));
+	xsk.fd = xsk.map_fd = xsk.prog_fd = xsk.link_fd = -1;
+}
+
+/*
+ * Set up XSK on queue 0 of iface.  When @rx is set we also load and
+ * attach the XDP program and register with the event loop.  Returns
+ * non-zero on failure, after cleaning up, so callers can fall back to
+ * the socket path.
+ */
+int xdp_init(int rx)
+{
+	struct sockaddr_xdp sxdp = { 0 };
+	size_t len = bytes;
+	const char *step;
+	struct gr *g;
+
+	/* No multi-buffer support, payload must fit in one UMEM frame */
+	for (g = rx ? NULL : TAILQ_FIRST(&groups); g; g = TAILQ_NEXT(g, entry)) {
+		if (gr_size(g) > len)
+			len = gr_size(g);
+	}
+	if (len + ETH_HLEN + IP6_HLEN + UDP_HLEN > FRAME_SIZE - XDP_PACKET_HEADROOM) {
+		errno = EMSGSIZE;
+		step = "checking payload size";
+		goto fail;
+	}
+
+	xsk.ifindex = if_nametoindex(iface);
+	if (!xsk.ifindex) {
+		step = "finding interface";
+		goto fail;
+	}
+
+	/* Sender builds its own IP headers, need an address to send from */
+	if (!rx && ((need4 && ifinfo(iface, &xsk.src4, AF_INET) <= 0) ||
+		    (need6 && ifinfo(iface, &xsk.src6, AF_INET6) <= 0))) {
+		step = "finding interface address";
+		goto fail;
+	}
+
+	if (hwaddr(iface, xsk.mac)) {
+		step = "reading MAC address";
+		goto fail;
+	}
+
+	xsk.fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (xsk.fd < 0) {
+		step = "opening AF_XDP socket";
+		goto fail;
+	}
+
+	if (umem_init(rx)) {
+		step = "setting up UMEM and rings";
+		goto fail;
+	}
+
+	sxdp.sxdp_family   = AF_XDP;
+	sxdp.sxdp_ifindex  = xsk.ifindex;
+	sxdp.sxdp_queue_id = 0;
+	sxdp.sxdp_flags    = XDP_USE_NEED_WAKEUP;
+	if (bind(xsk.fd, (struct sockaddr *)&sxdp, sizeof(sxdp))) {
+		step = "binding AF_XDP socket";
+		goto fail;
+	}
+	busy_poll(xsk.fd);
+
+	if (rx) {
+		if (tbl_init()) {
+			step = "allocating group table";
+			goto fail;
+		}
+
+		xsk.map_fd = map_create();
+		if (xsk.map_fd < 0) {
+			step = "creating XSKMAP";
+			goto fail;
+		}
+
+		if (map_update(xsk.map_fd, 0, xsk.fd)) {
+			step = "adding socket to XSKMAP";
+			goto fail;
+		}
+
+		xsk.prog_fd = prog_load(xsk.map_fd);
+		if (xsk.prog_fd < 0) {
+			step = "loading XDP program";
+			goto fail;
+		}
+
+		xsk.link_fd = prog_attach(xsk.prog_fd, xsk.ifindex);
+		if (xsk.link_fd < 0) {
+			step = "attaching XDP program";
+			goto fail;
+		}
+
+		if (pev_sock_add(xsk.fd, rx_cb, NULL) < 0) {
+			step = "adding socket to event loop";
+			goto fail;
+		}
+	}
+
+	PRINT("Using AF_XDP on %s queue 0, ifindex: %d, sd: %d", iface, xsk.ifindex, xsk.fd);
+	return 0;
+fail:
+	ERROR("AF_XDP failed %s: %s, falling back to sockets.", step, strerror(errno));
+	xdp_exit();
+	return 1;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */